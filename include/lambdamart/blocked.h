@@ -0,0 +1,61 @@
+#ifndef LAMBDAMART_BLOCKED_H
+#define LAMBDAMART_BLOCKED_H
+
+#include <lambdamart/types.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace LambdaMART {
+
+    // data cache sizes of the machine in bytes
+    struct CacheSizes {
+        size_t l1;
+        size_t l2;
+
+        // read once from sysconf or /sys/devices/system/cpu/cpu0/cache; 32 KiB and 1 MiB where neither knows
+        static const CacheSizes& get();
+    };
+
+    /*
+     * Consecutive trees of a Model flattened for blocked scoring. A block takes trees until its
+     * nodes fill half of L2, so it stays cached while a range of samples is scored against it.
+     * The features its trees split on are renumbered 0..features.size()-1 in ascending order:
+     * before the block scores a tile of samples, their values of these features are gathered
+     * into one contiguous buffer, and block_samples is the tile that keeps it in half of L1.
+     */
+    struct TreeBlock {
+        // a split; child references >= 0 are nodes, negative ones are ~index into leaves
+        struct Node {
+            featval_t threshold;
+            uint32_t  feature;  // index into features
+            int32_t   left;
+            int32_t   right;
+        };
+
+        std::vector<feature_t> features;
+        std::vector<int32_t>   columns;  // index in features of every feature up to features.back(), or -1
+        std::vector<int32_t>   roots;    // reference of the root of every tree
+        std::vector<double>    weights;  // of every tree
+        std::vector<Node>      nodes;
+        std::vector<score_t>   leaves;
+        sample_t               block_samples;
+
+        size_t size_in_bytes() const {
+            return nodes.size() * sizeof(Node) + leaves.size() * sizeof(score_t) + roots.size() * sizeof(int32_t);
+        }
+
+        // output of tree t of the block for the gathered values of one sample
+        inline score_t predict_tree(size_t t, const featval_t* values) const {
+            int32_t n = roots[t];
+            while (n >= 0) {
+                const Node& node = nodes[n];
+                n = values[node.feature] <= node.threshold ? node.left : node.right;
+            }
+            return leaves[~n];
+        }
+    };
+
+}
+
+#endif //LAMBDAMART_BLOCKED_H
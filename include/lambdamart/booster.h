@@ -2,22 +2,54 @@
 #define LAMBDAMART_BOOSTER_H
 
 #include <lambdamart/model.h>
+#include <lambdamart/checkpoint.h>
+#include <future>
 
 namespace LambdaMART {
     class Booster {
         Dataset*                  train_dataset;
-        RawDataset*               valid_dataset;
+        BinnedDataset*            valid_dataset;
         Config*                   config;
         uint64_t                  num_samples;
-        std::vector<double>       current_scores;
-        std::vector<double>       gradients;
-        std::vector<double>       hessians;
-        LambdaRank*               train_ranker;
-        LambdaRank*               valid_ranker;
+        std::vector<score_t>      current_scores;
+        std::vector<score_t>      valid_scores;    // running model output on the validation set
+        std::vector<gradient_t>   gradients;
+        std::vector<gradient_t>   hessians;
+        Objective*                train_objective;
+        Objective*                valid_objective;
         Model*                    model;
 
-        inline string get_train_ndcg_string() {
-            vector<double> result = train_ranker->eval(current_scores.data());
+        // early stopping state
+        double                    best_ndcg = -1.0;
+        int                       best_iter = 0;
+
+        // evaluation of one iteration, computed on a background thread from score snapshots
+        struct EvalResult {
+            int iter;
+            bool log;
+            vector<double> train, valid;
+        };
+        std::future<EvalResult>   pending_eval;
+        std::vector<score_t>      train_snapshot, valid_snapshot;
+
+        // snapshots the scores after iteration `iter` and starts evaluating them in the background,
+        // so the next iteration's gradients and tree are computed meanwhile
+        void start_eval(int iter, bool log);
+        // waits for the running evaluation, logs it and updates early stopping; returns true to stop
+        bool finish_eval();
+
+        // trees serialized as they are added, so a checkpoint snapshot never re-serializes the model
+        std::string               serialized_trees;
+
+        // starts from the trees of an existing model file instead of an empty model
+        void init_from_model(const std::string& path);
+
+        // binary snapshot of everything needed to continue after iteration `iter`
+        std::string checkpoint_snapshot(int iter);
+        // restores the state saved by checkpoint_snapshot, returns its iteration
+        int restore_checkpoint(const std::string& path);
+
+        inline string get_train_ndcg_string(const vector<double>& result) {
             string tmp;
             for (size_t i = 0 ; i < result.size(); ++i) {
                 tmp += "\ttrain-ndcg@" + to_string(config->eval_at[i]) + ":" + to_string(result[i]);
@@ -25,9 +57,7 @@ namespace LambdaMART {
             return tmp;
         }
 
-        inline string get_valid_ndcg_string() {
-            vector<double> predictions = model->predict(valid_dataset);
-            vector<double> result = valid_ranker->eval(predictions.data());
+        inline string get_valid_ndcg_string(const vector<double>& result) {
             string tmp;
             for (size_t i = 0 ; i < result.size(); ++i) {
                 tmp += "\tvalid-ndcg@" + to_string(config->eval_at[i]) + ":" + to_string(result[i]);
@@ -38,7 +68,7 @@ namespace LambdaMART {
     public:
         Booster() = delete;
 
-        Booster(Dataset* _train_dataset, RawDataset* _valid_dataset, Config* _config)
+        Booster(Dataset* _train_dataset, BinnedDataset* _valid_dataset, Config* _config)
           : train_dataset(_train_dataset), valid_dataset(_valid_dataset), config(_config)
         {
             model = nullptr;
@@ -46,8 +76,9 @@ namespace LambdaMART {
             current_scores.resize(num_samples, 0.0);
             gradients.resize(num_samples);
             hessians.resize(num_samples);
-            train_ranker = new LambdaRank(*train_dataset, *config);
-            valid_ranker = valid_dataset ? new LambdaRank(*valid_dataset, *config) : nullptr;
+            if (valid_dataset) valid_scores.resize(valid_dataset->num_samples(), 0.0);
+            train_objective = Objective::create(*train_dataset, *config);
+            valid_objective = valid_dataset ? Objective::create(*valid_dataset, *config) : nullptr;
         }
 
         Model* train();
@@ -0,0 +1,46 @@
+#ifndef LAMBDAMART_CHECKPOINT_H
+#define LAMBDAMART_CHECKPOINT_H
+
+#include <lambdamart/log.h>
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace LambdaMART {
+
+    /*
+     * Writes checkpoint snapshots on a background thread, so the training loop only pays
+     * for building the snapshot in memory. A snapshot that is still waiting when the next
+     * one arrives is replaced by it. The file is written to `path.tmp` and renamed, so a
+     * crash never leaves a half-written checkpoint behind.
+     */
+    class CheckpointWriter {
+    public:
+        explicit CheckpointWriter(const std::string& path);
+
+        // waits until the last submitted snapshot is on disk
+        ~CheckpointWriter();
+
+        CheckpointWriter(CheckpointWriter const &) = delete;
+        CheckpointWriter& operator=(CheckpointWriter const &) = delete;
+
+        void submit(std::string&& snapshot);
+
+    private:
+        std::string             path;
+        std::thread             worker;
+        std::mutex              mutex;
+        std::condition_variable cond;
+        std::string             pending;
+        bool                    has_pending = false;
+        bool                    stopping = false;
+
+        void run();
+        void write(const std::string& snapshot);
+    };
+
+}
+
+#endif //LAMBDAMART_CHECKPOINT_H
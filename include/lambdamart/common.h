@@ -15,6 +15,8 @@
 #include <iterator>
 #include <type_traits>
 #include <iomanip>
+#include <cstring>
+#include <charconv>
 
 #ifdef _MSC_VER
 #include "intrin.h"
@@ -362,6 +364,50 @@ return 10;
 #endif
     }
 
+    // writes the shortest text that reads back as exactly `value`, without terminator;
+    // returns the end of the text. 32 bytes are always enough
+    template<typename T>
+    inline static char* ToShortestStr(T value, char* buffer) {
+        return std::to_chars(buffer, buffer + 32, value).ptr;
+    }
+
+    // IEEE 754 binary16 of value, rounded to nearest even; values beyond its range become infinities
+    inline static uint16_t FloatToHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = (bits >> 16) & 0x8000;
+        const uint32_t exponent = (bits >> 23) & 0xff;
+        uint32_t mantissa = bits & 0x7fffff;
+        if (exponent == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+        const int e = static_cast<int>(exponent) - 127 + 15;
+        if (e >= 31) return sign | 0x7c00;
+        // dropped bits above half of the last kept bit round up, exactly half rounds to even
+        auto round = [](uint32_t kept, uint32_t mantissa, int shift) {
+            const uint32_t rest = mantissa & ((1u << shift) - 1), half = 1u << (shift - 1);
+            return kept + (rest > half || (rest == half && (kept & 1)));
+        };
+        if (e <= 0) {
+            if (e < -10) return sign;
+            mantissa |= 0x800000;
+            return sign | round(mantissa >> (14 - e), mantissa, 14 - e);
+        }
+        // a carry out of the mantissa correctly moves to the next exponent, or to infinity
+        return sign | round((e << 10) | (mantissa >> 13), mantissa, 13);
+    }
+
+    inline static float HalfToFloat(uint16_t half) {
+        const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+        const uint32_t exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+        if (exponent == 0) {
+            const float value = std::ldexp(static_cast<float>(mantissa), -24);
+            return sign ? -value : value;
+        }
+        const uint32_t bits = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
     inline static const char* SkipSpaceAndTab(const char* p) {
         while (*p == ' ' || *p == '\t') {
             ++p;
@@ -824,5 +870,40 @@ return 10;
         }
     }
 
+    // appends the raw bytes of a trivially copyable value
+    template <typename T>
+    inline static void AppendBinary(std::string* out, const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "AppendBinary needs a trivially copyable type");
+        out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    inline static void AppendBinary(std::string* out, const std::vector<T>& values) {
+        AppendBinary(out, static_cast<uint64_t>(values.size()));
+        out->append(reinterpret_cast<const char*>(values.data()), sizeof(T) * values.size());
+    }
+
+    // reads a value written by AppendBinary and advances *p
+    template <typename T>
+    inline static void ReadBinary(const char** p, const char* end, T* value) {
+        if (static_cast<size_t>(end - *p) < sizeof(T)) {
+            Log::Fatal("Unexpected end of binary data");
+        }
+        std::memcpy(value, *p, sizeof(T));
+        *p += sizeof(T);
+    }
+
+    template <typename T>
+    inline static void ReadBinary(const char** p, const char* end, std::vector<T>* values) {
+        uint64_t size;
+        ReadBinary(p, end, &size);
+        if (static_cast<uint64_t>(end - *p) / sizeof(T) < size) {
+            Log::Fatal("Unexpected end of binary data");
+        }
+        values->resize(size);
+        std::memcpy(values->data(), *p, sizeof(T) * size);
+        *p += sizeof(T) * size;
+    }
+
 }
 #endif //LAMBDAMART_COMMON_H
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef LAMBDAMART_COMPILED_H
+#define LAMBDAMART_COMPILED_H
+
+#include <lambdamart/dataset.h>
+#include <lambdamart/types.h>
+
+#include <string>
+#include <vector>
+
+namespace LambdaMART {
+
+    /*
+     * A model written by Model::export_cpp and built into a shared object. Every tree is
+     * compiled code with its thresholds and outputs as constants, so scoring a row takes
+     * no pointer chasing through TreeNodes. Scores are the same as those of the Model.
+     */
+    class CompiledModel {
+    public:
+        explicit CompiledModel(const std::string& path);
+        ~CompiledModel();
+
+        CompiledModel(CompiledModel const &) = delete;
+        CompiledModel& operator=(CompiledModel const &) = delete;
+
+        // rows passed to predict_row have at least this many features
+        feature_t num_features() const { return num_feat; }
+
+        inline double predict_row(const featval_t* row) const {
+            return predict_fn(row);
+        }
+
+        // same as Model::predict
+        std::vector<double> predict(const RawDataset* data) const;
+
+    private:
+        void*     handle;
+        double    (*predict_fn)(const featval_t*);
+        feature_t num_feat;
+    };
+
+}
+
+#endif //LAMBDAMART_COMPILED_H
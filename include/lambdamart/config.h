@@ -45,6 +45,10 @@ namespace LambdaMART {
             }
             infile.close();
 
+            GetString("task", &task);
+            if (task != "train" && task != "predict" && task != "export" && task != "serve" && task != "loadgen"
+                && task != "compress")
+                Log::Fatal("Unknown task %s", task.c_str());
             GetString("train_data", &train_data);
             GetString("train_query", &train_query);
             GetString("train_label", &train_label);
@@ -56,26 +60,108 @@ namespace LambdaMART {
             if(max_depth < 2)
                 Log::Fatal("Max_depth should not be less than 2");
             GetInt("max_splits", &max_splits);
+            GetInt("max_leaves", &max_leaves);
+            if (max_leaves < 0 || max_leaves == 1)
+                Log::Fatal("max_leaves should be 0 or at least 2");
             GetInt("min_data_in_leaf", &min_data_in_leaf);
             GetDouble("min_impurity_to_split", &min_impurity_to_split);
             GetDouble("min_gain_to_split", &min_gain_to_split);
+            GetDouble("bagging_fraction", &bagging_fraction);
+            GetInt("bagging_freq", &bagging_freq);
+            GetInt("bagging_seed", &bagging_seed);
+            if (bagging_fraction <= 0.0 || bagging_fraction > 1.0)
+                Log::Fatal("bagging_fraction should be in (0, 1]");
+            GetDouble("feature_fraction", &feature_fraction);
+            GetDouble("feature_fraction_bynode", &feature_fraction_bynode);
+            GetInt("feature_fraction_seed", &feature_fraction_seed);
+            if (feature_fraction <= 0.0 || feature_fraction > 1.0 || feature_fraction_bynode <= 0.0 || feature_fraction_bynode > 1.0)
+                Log::Fatal("feature_fraction and feature_fraction_bynode should be in (0, 1]");
+            GetBool("quantized_gradients", &quantized_gradients);
+            GetInt("gradient_bits", &gradient_bits);
+            if (quantized_gradients && (gradient_bits < 2 || gradient_bits > 16))
+                Log::Fatal("gradient_bits should be between 2 and 16");
+            GetBool("goss", &goss);
+            GetDouble("top_rate", &top_rate);
+            GetDouble("other_rate", &other_rate);
+            if (goss) {
+                if (top_rate < 0.0 || other_rate <= 0.0 || top_rate + other_rate > 1.0)
+                    Log::Fatal("goss needs top_rate >= 0, other_rate > 0 and top_rate + other_rate <= 1");
+                if (bagging_freq > 0 && bagging_fraction < 1.0)
+                    Log::Fatal("Cannot use bagging and goss together");
+                if (quantized_gradients)
+                    Log::Fatal("Cannot use quantized_gradients and goss together");
+            }
             GetInt("verbosity", &verbosity);
             Log::ResetLogLevel(LogLevel(verbosity));
             { int t; GetInt("max_bin", &t) && (max_bin = t > 255 ? 255 : t); }
             GetInt("min_data_in_bin", &min_data_in_bin);
+            GetBool("enable_bundle", &enable_bundle);
+            GetString("input_model", &input_model);
             GetString("output_model", &output_model);
             GetString("output_result", &output_result);
+            GetString("result_format", &result_format);
+            if (result_format != "text" && result_format != "float" && result_format != "double")
+                Log::Fatal("result_format should be text, float or double");
+            GetString("predict_data", &predict_data);
+            GetString("row_layout", &row_layout);
+            if (row_layout != "csr" && row_layout != "dense")
+                Log::Fatal("row_layout should be csr or dense");
+            GetString("compiled_model", &compiled_model);
+            GetString("socket_path", &socket_path);
+            GetInt("serve_threads", &serve_threads);
+            GetInt("serve_batch_size", &serve_batch_size);
+            GetInt("serve_max_connections", &serve_max_connections);
+            GetInt("loadgen_connections", &loadgen_connections);
+            GetInt("loadgen_requests", &loadgen_requests);
+            GetInt("loadgen_batch_size", &loadgen_batch_size);
+            if (serve_batch_size < 1 || serve_max_connections < 1 || loadgen_connections < 1 || loadgen_requests < 1
+                || loadgen_batch_size < 1)
+                Log::Fatal("serve_batch_size, serve_max_connections and the loadgen parameters should be positive");
+            GetString("output_cpp", &output_cpp);
+            GetDouble("prune_tolerance", &prune_tolerance);
+            if (prune_tolerance < 0)
+                Log::Fatal("prune_tolerance should not be negative");
+            GetInt("predict_chunk_size", &predict_chunk_size);
+            if (predict_chunk_size < 1)
+                Log::Fatal("predict_chunk_size should be positive");
+            GetString("checkpoint_path", &checkpoint_path);
+            GetInt("checkpoint_interval", &checkpoint_interval);
+            GetString("resume_from", &resume_from);
+            GetString("objective", &objective);
             GetDouble("sigmoid", &sigmoid);
             GetInt("max_position", &max_position);
             GetInt("max_label", &max_label);
             GetIntVector("eval_at", &eval_at);
             GetInt("eval_interval", &eval_interval);
+            GetInt("early_stopping_round", &early_stopping_round);
+            GetInt("early_stopping_eval_at", &early_stopping_eval_at);
+            if (early_stopping_round > 0) {
+                if (eval_at.empty())
+                    Log::Fatal("early_stopping_round needs at least one eval_at position");
+                if (early_stopping_eval_at == 0) early_stopping_eval_at = eval_at.back();
+                if (std::find(eval_at.begin(), eval_at.end(), early_stopping_eval_at) == eval_at.end())
+                    Log::Fatal("early_stopping_eval_at %d is not one of the eval_at positions", early_stopping_eval_at);
+            }
+            GetBool("pair_sampling", &pair_sampling);
+            GetInt("pair_sampling_min_query_size", &pair_sampling_min_query_size);
+            GetInt("pair_sampling_budget", &pair_sampling_budget);
+            if (pair_sampling_budget < 1)
+                Log::Fatal("pair_sampling_budget should be positive");
+            GetInt("objective_seed", &objective_seed);
         }
 
 #pragma region Parameters
         unordered_map<string, string> properties;
 
 #pragma region Core Parameters
+        // desc = ``train``: train on ``train_data`` and score ``valid_data``
+        // desc = ``predict``: score ``predict_data`` with ``input_model``, streaming the file in chunks
+        // desc = ``export``: write ``input_model`` as C++ source to ``output_cpp``
+        // desc = ``serve``: score requests on the Unix socket ``socket_path`` with ``input_model``
+        // desc = ``loadgen``: send the rows of ``predict_data`` to a ``serve`` process and report its latency
+        // desc = ``compress``: write ``input_model`` compressed for inference to ``output_model``, and report
+        // desc = the NDCG it loses on ``valid_data``
+        string task = "train";
         string train_data, train_query, train_label;
         string valid_data, valid_query;
         int num_iterations = 100;
@@ -87,10 +173,45 @@ namespace LambdaMART {
 
         int max_depth = 9;
         int max_splits = 256;
+
+        // desc = ``> 0``: grow trees best-first, always splitting the leaf with the largest gain,
+        // desc = until they have ``max_leaves`` leaves; ``max_depth`` still bounds their depth
+        // desc = ``0``: grow level by level with up to ``max_splits`` splits per level
+        int max_leaves = 0;
         int min_data_in_leaf = 1;
         double min_gain_to_split = 1e-6;
         double min_impurity_to_split = 1e-6;
 
+        // desc = fraction of queries used to build a tree; whole queries are kept or dropped
+        // desc = only used when ``bagging_freq > 0``
+        double bagging_fraction = 1.0;
+
+        // desc = draw a new query sample every ``bagging_freq`` iterations; ``<= 0`` disables bagging
+        int bagging_freq = 0;
+
+        // desc = random seed for bagging and goss
+        int bagging_seed = 3;
+
+        // desc = fraction of features considered by each tree
+        double feature_fraction = 1.0;
+
+        // desc = fraction of the tree's features considered at each level of the tree
+        double feature_fraction_bynode = 1.0;
+
+        // desc = random seed for ``feature_fraction`` and ``feature_fraction_bynode``
+        int feature_fraction_seed = 2;
+
+        // desc = build histograms from gradients rounded stochastically to ``gradient_bits``-bit integers,
+        // desc = accumulated in integer bins; leaf outputs still use the exact gradients
+        bool quantized_gradients = false;
+        int gradient_bits = 8;
+
+        // desc = gradient-based one-side sampling: every tree keeps the ``top_rate`` fraction of samples
+        // desc = with the largest gradients and a random ``other_rate`` fraction of the rest, reweighted
+        bool goss = false;
+        double top_rate = 0.2;
+        double other_rate = 0.1;
+
 #pragma endregion
 
 #pragma region IO Parameters
@@ -102,16 +223,75 @@ namespace LambdaMART {
         uint8_t max_bin = 255;
         int min_data_in_bin = 3; //unused now in v1
 
+        // desc = store features that are never off their most frequent bin on the same sample as one column
+        bool enable_bundle = true;
+
         // desc = max cache size in MB for historical histogram; ``< 0`` means no limit
 //        double histogram_pool_size = -1.0;  // TODO: maybe useful later
 
-        string output_model = "model.txt";
+        // desc = continue boosting from this model file; ``num_iterations`` trees are added to it
+        string input_model;
+        string output_model = "model.bin";
         string output_result = "predict_result.txt";
 
+        // desc = format of ``output_result``: ``text`` (one score per line, printed with the shortest text
+        // desc = that reads back as the same score), or ``float`` / ``double`` (raw values, no header)
+        string result_format = "text";
+
+        // desc = LibSVM file scored by ``task = predict``; its labels are ignored
+        string predict_data;
+
+        // desc = how ``task = compress`` and ``task = loadgen`` keep the rows they load: ``csr`` (the nonzeros
+        // desc = of each row) or ``dense`` (every feature of every row, faster to score on dense data)
+        string row_layout = "csr";
+
+        // desc = shared object built from the output of ``task = export``; when set, ``task = predict``
+        // desc = scores with it instead of ``input_model``
+        string compiled_model;
+        string output_cpp = "model.cpp";
+
+        // desc = ``task = compress`` merges leaves into one while their weighted outputs differ by at most
+        // desc = this much; a score moves by at most half of it per tree, beyond the float16 rounding of leaves
+        double prune_tolerance = 0.0;
+
+        // desc = Unix socket of ``task = serve`` and ``task = loadgen``
+        string socket_path = "lambdamart.sock";
+
+        // desc = number of scoring threads of ``task = serve``; ``<= 0`` means one per core
+        int serve_threads = 0;
+
+        // desc = a ``serve`` worker scores queued requests together until they reach this many rows; it is
+        // desc = also the most rows one request may have
+        int serve_batch_size = 256;
+
+        // desc = connections ``task = serve`` handles at once; further ones wait to be accepted
+        int serve_max_connections = 64;
+
+        // desc = ``task = loadgen`` opens ``loadgen_connections`` connections that each send
+        // desc = ``loadgen_requests`` requests of ``loadgen_batch_size`` rows
+        int loadgen_connections = 4;
+        int loadgen_requests = 1000;
+        int loadgen_batch_size = 100;
+
+        // desc = number of rows ``task = predict`` reads, scores and writes at a time; bounds its memory
+        int predict_chunk_size = 16384;
+
+        // desc = write a training checkpoint to ``checkpoint_path`` every ``checkpoint_interval`` iterations
+        // desc = ``<= 0`` disables checkpoints; files are written by a background thread
+        string checkpoint_path = "checkpoint.bin";
+        int checkpoint_interval = 0;
+
+        // desc = continue training from this checkpoint, with the same data and parameters
+        string resume_from;
+
 #pragma endregion
 
 #pragma region Objective Parameters
 
+        // desc = training objective: ``lambdarank``, ``ranknet``, ``lambdarank_map`` or ``regression``
+        // desc = all objectives report NDCG during training
+        string objective = "lambdarank";
+
         // desc = parameter for the sigmoid function
         double sigmoid = 1.0;
 
@@ -132,6 +312,27 @@ namespace LambdaMART {
         // desc = evaluate training and validation ndcg every ``eval_interval`` iterations
         int eval_interval = 1;
 
+        // desc = stop training when valid-ndcg@``early_stopping_eval_at`` has not improved for this many iterations
+        // desc = the returned model is truncated to the best iteration; ``<= 0`` disables early stopping
+        int early_stopping_round = 0;
+
+        // desc = the ``eval_at`` position watched by early stopping; ``0`` means the last entry of ``eval_at``
+        int early_stopping_eval_at = 0;
+
+        // desc = sample a fixed budget of pairs per document instead of enumerating all pairs of long queries
+        // desc = the sampled lambdas are reweighted so that they stay unbiased estimates of the full ones
+        bool pair_sampling = false;
+
+        // desc = only queries with more than ``pair_sampling_min_query_size`` documents are sampled
+        int pair_sampling_min_query_size = 500;
+
+        // desc = number of pairs sampled per document; documents with at most this many
+        // desc = lower-labeled partners still enumerate all of their pairs
+        int pair_sampling_budget = 64;
+
+        // desc = random seed for the objective (used by ``pair_sampling``)
+        int objective_seed = 5;
+
 #pragma endregion
 
 #pragma endregion
@@ -26,6 +26,30 @@ namespace LambdaMART {
     struct Binner{
         // NOTE: Features are assumed to be arranged accordingly
         vector<vector<double>> thresholds;
+        // bins per feature; bin b holds the values in (thresholds[f][b-1], thresholds[f][b]], the last bin has no upper bound
+        vector<int> num_bins;
+
+        // bin of `value` in feature f, the same one training gave to that value
+        inline bin_t value_to_bin(feature_t f, double value) const {
+            const int last = num_bins[f] - 1;
+            if (last <= 0) return 0;
+            const double* t = thresholds[f].data();
+            return static_cast<bin_t>(lower_bound(t, t + last, value) - t);
+        }
+
+        // bin of feature f whose upper boundary is `threshold` once rounded to featval_t, as split
+        // thresholds are stored; false when no boundary of f is
+        inline bool threshold_to_bin(feature_t f, featval_t threshold, bin_t* bin) const {
+            if (f >= thresholds.size() || num_bins[f] <= 1) return false;
+            const double* t = thresholds[f].data();
+            const double* last = t + num_bins[f] - 1;
+            const double* it = lower_bound(t, last, threshold, [](double boundary, featval_t value) {
+                return static_cast<featval_t>(boundary) < value;
+            });
+            if (it == last || static_cast<featval_t>(*it) != threshold) return false;
+            *bin = static_cast<bin_t>(it - t);
+            return true;
+        }
     };
 
     class Feature {
@@ -99,10 +123,39 @@ namespace LambdaMART {
         }
     };
 
+    /*
+     * Mutually exclusive features stored as one column: on every sample at most one of them is off
+     * its default (most frequent) bin. The non-default bins of feature k occupy the bundle bins
+     * [offsets[k], offsets[k+1]) in order; bundle bin 0 means all features are at their default bin.
+     */
+    struct FeatureBundle {
+        vector<feature_t> features;
+        vector<int> offsets;
+        vector<int> default_bins;
+        int num_bins = 1;
+        vector<bin_t> bin_index;
+
+        // bin of the k-th feature of the bundle on a sample with the given bundle bin
+        inline int feature_bin(size_t k, int bundle_bin) const {
+            if (bundle_bin < offsets[k] || bundle_bin >= offsets[k + 1]) return default_bins[k];
+            const int bin = bundle_bin - offsets[k];
+            return bin < default_bins[k] ? bin : bin + 1;
+        }
+
+        // bundle bin of bin `bin` of the k-th feature; -1 for its default bin
+        inline int bundle_bin(size_t k, int bin) const {
+            if (bin == default_bins[k]) return -1;
+            return offsets[k] + (bin < default_bins[k] ? bin : bin - 1);
+        }
+    };
+
     class Dataset {
         vector<Feature> data; // feature major; d rows, n columns
         int bin_size, bin_cnt, max_lbl;
+        bool enable_bundle;
         Binner binner;
+        vector<FeatureBundle> bundles;
+        vector<int> feature_to_bundle;  // -1: the feature keeps its own column
 
     protected:
         void load_data_from_file(const char* path, vector<vector<pair<int, double>>>& data, vector<label_t> &rank, int& max_d){
@@ -160,6 +213,7 @@ namespace LambdaMART {
 
         explicit Dataset(Config* config = nullptr){
             bin_cnt = config ? config->max_bin : 16;
+            enable_bundle = config ? config->enable_bundle : false;
             this->max_lbl = INT_MIN;
             this->d = INT_MIN;
         }
@@ -195,8 +249,85 @@ namespace LambdaMART {
                 feat.sort();
                 feat.bin(this->bin_size, this->n);
                 this->binner.thresholds.emplace_back(feat.threshold);
+                this->binner.num_bins.emplace_back(feat.bin_count());
             }
             Log::Info("Loaded dataset of size: %d samples x %d features", this->n, this->d);
+
+            feature_to_bundle.assign(this->d, -1);
+            if (enable_bundle) bundle_features();
+        }
+
+        // greedily packs features that are never off their default bin on the same sample into
+        // bundles of at most bin_cnt bins; bundled features give up their own bin_index column
+        void bundle_features() {
+            vector<int> default_bin(d);
+            vector<vector<sample_t>> nondefault(d);
+            for (int f = 0; f < d; ++f) {
+                const Feature& feat = data[f];
+                vector<sample_t> counts(max(feat.bin_count(), 1), 0);
+                for (int i = 0; i < n; ++i) ++counts[feat.bin_index[i]];
+                default_bin[f] = static_cast<int>(max_element(counts.begin(), counts.end()) - counts.begin());
+                for (int i = 0; i < n; ++i) {
+                    if (feat.bin_index[i] != default_bin[f]) nondefault[f].push_back(i);
+                }
+            }
+
+            // sparse features have the most freedom, so the dense ones pick their bundle first
+            vector<int> order;
+            for (int f = 0; f < d; ++f) {
+                if (data[f].bin_count() > 1) order.push_back(f);
+            }
+            stable_sort(order.begin(), order.end(), [&](int a, int b) { return nondefault[a].size() > nondefault[b].size(); });
+
+            struct Group { vector<feature_t> features; vector<bool> used; sample_t used_count; int num_bins; };
+            vector<Group> groups;
+            for (int f : order) {
+                const int extra_bins = data[f].bin_count() - 1;
+                int chosen = -1;
+                for (size_t g = 0; g < groups.size() && chosen < 0; ++g) {
+                    Group& group = groups[g];
+                    if (group.used_count + nondefault[f].size() > static_cast<size_t>(n) || group.num_bins + extra_bins > bin_cnt) continue;
+                    bool conflict = false;
+                    for (sample_t i : nondefault[f]) {
+                        if (group.used[i]) { conflict = true; break; }
+                    }
+                    if (!conflict) chosen = static_cast<int>(g);
+                }
+                if (chosen < 0) {
+                    chosen = static_cast<int>(groups.size());
+                    groups.push_back(Group{{}, vector<bool>(n, false), 0, 1});
+                }
+                Group& group = groups[chosen];
+                group.features.push_back(f);
+                for (sample_t i : nondefault[f]) group.used[i] = true;
+                group.used_count += nondefault[f].size();
+                group.num_bins += extra_bins;
+            }
+
+            int num_bundled = 0;
+            for (auto& group : groups) {
+                if (group.features.size() < 2) continue;
+                FeatureBundle bundle;
+                bundle.features = group.features;
+                std::sort(bundle.features.begin(), bundle.features.end());
+                bundle.bin_index.assign(n, 0);
+                bundle.offsets.push_back(1);
+                for (size_t k = 0; k < bundle.features.size(); ++k) {
+                    const feature_t f = bundle.features[k];
+                    bundle.default_bins.push_back(default_bin[f]);
+                    bundle.offsets.push_back(bundle.offsets.back() + data[f].bin_count() - 1);
+                    for (sample_t i : nondefault[f]) {
+                        bundle.bin_index[i] = static_cast<bin_t>(bundle.bundle_bin(k, data[f].bin_index[i]));
+                    }
+                    feature_to_bundle[f] = static_cast<int>(bundles.size());
+                    vector<int>().swap(data[f].bin_index);
+                }
+                bundle.num_bins = bundle.offsets.back();
+                num_bundled += static_cast<int>(bundle.features.size());
+                bundles.emplace_back(std::move(bundle));
+            }
+            if (!bundles.empty())
+                Log::Info("Bundled %d exclusive features into %d columns", num_bundled, static_cast<int>(bundles.size()));
         }
 
         void load_debug_dataset(const char* data_path, const char* label_path, const char* query_path, int num_feat){
@@ -282,6 +413,15 @@ namespace LambdaMART {
             }
         }
 
+        const vector<FeatureBundle>& get_bundles() const {
+            return bundles;
+        }
+
+        // index into get_bundles() of the bundle holding feature f, or -1
+        int bundle_of(feature_t f) const {
+            return feature_to_bundle.empty() ? -1 : feature_to_bundle[f];
+        }
+
         // returns dimensions of raw data
         pair<int, int> shape() const{
             return make_pair(this->n, this->d);
@@ -314,32 +454,151 @@ namespace LambdaMART {
         }
     };
 
+    // row storage of a RawDataset
+    enum class RowLayout {
+        kCSR,    // the nonzeros of each row, sorted by feature
+        kDense   // every feature of every row, row-major
+    };
+
+    inline RowLayout row_layout_from_string(const std::string& name) {
+        if (name == "csr") return RowLayout::kCSR;
+        if (name == "dense") return RowLayout::kDense;
+        Log::Fatal("Unknown row_layout %s", name.c_str());
+        return RowLayout::kCSR;
+    }
+
+    /*
+     * Feature values of the samples to score, kept row by row. The CSR layout takes memory proportional to
+     * the nonzeros of the LibSVM input; the dense layout takes n x d values but reads a feature in one load.
+     */
     class RawDataset: public Dataset{
     private:
-        vector<vector<pair<int, featval_t>>> raw_data;
-        vector<vector<featval_t>> data;
+        RowLayout layout = RowLayout::kCSR;
+        // kCSR: the nonzeros of row i are [row_begin[i], row_begin[i+1])
+        vector<size_t> row_begin;
+        vector<feature_t> row_features;
+        vector<featval_t> row_values;
+        // kDense: row i is [i*d, (i+1)*d)
+        vector<featval_t> dense;
     public:
-        void load_dataset(const char* data_path, const char* query_path) {
+        // without a query file, all samples form one query
+        void load_dataset(const char* data_path, const char* query_path, RowLayout layout = RowLayout::kCSR) {
+            vector<vector<pair<int, double>>> raw_data;
             load_data_from_file(data_path, raw_data, this->rank, this->d);
             this->n = raw_data.size();
-            init_data();
+            this->d = max(this->d, 0);
+            if (query_path != nullptr && *query_path != '\0') {
+                load_query_from_file(query_path);
+            } else {
+                query_boundaries = {0, static_cast<sample_t>(this->n)};
+            }
 
-            load_query_from_file(query_path);
+            this->layout = layout;
+            if (layout == RowLayout::kDense) {
+                dense.assign(static_cast<size_t>(this->n) * this->d, 0.0);
+                for (int i = 0; i < this->n; ++i) {
+                    for (auto& entry : raw_data[i]) dense[static_cast<size_t>(i) * this->d + entry.first] = entry.second;
+                    vector<pair<int, double>>().swap(raw_data[i]);
+                }
+            } else {
+                row_begin.reserve(this->n + 1);
+                row_begin.push_back(0);
+                for (int i = 0; i < this->n; ++i) {
+                    // binary search in get_value needs the features of a row in order
+                    std::sort(raw_data[i].begin(), raw_data[i].end());
+                    for (auto& entry : raw_data[i]) {
+                        row_features.push_back(entry.first);
+                        row_values.push_back(entry.second);
+                    }
+                    row_begin.push_back(row_features.size());
+                    vector<pair<int, double>>().swap(raw_data[i]);
+                }
+            }
+            Log::Info("Loaded dataset of size: %d samples x %d features (%s)", this->n, this->d,
+                      layout == RowLayout::kDense ? "dense" : "csr");
+        }
 
-            for(int i=0; i<n; i++)
-                data.emplace_back(this->d, 0);
+        RowLayout get_layout() const {
+            return layout;
+        }
 
-            int row_index = 0;
-            for (auto &row: raw_data) {
-                for (auto &entry: row)
-                    this->data[row_index][entry.first] = entry.second;
-                row_index++;
+        // row i of the dense layout
+        inline const featval_t* dense_row(sample_t id) const {
+            return dense.data() + static_cast<size_t>(id) * this->d;
+        }
+
+        // value of feature f in row i, 0 when the row does not have it
+        inline featval_t get_value(sample_t id, feature_t f) const {
+            if (f >= static_cast<feature_t>(this->d)) return 0.0;
+            if (layout == RowLayout::kDense) return dense_row(id)[f];
+            const feature_t* first = row_features.data() + row_begin[id];
+            const feature_t* last = row_features.data() + row_begin[id + 1];
+            const feature_t* it = lower_bound(first, last, f);
+            return it != last && *it == f ? row_values[it - row_features.data()] : 0.0;
+        }
+
+        // writes the nonzeros of CSR row i into a zeroed buffer of d values; clear_row zeroes them again
+        inline void scatter_row(sample_t id, featval_t* buffer) const {
+            for (size_t k = row_begin[id]; k < row_begin[id + 1]; ++k) buffer[row_features[k]] = row_values[k];
+        }
+
+        // writes the features below num_feat of row i into a zeroed buffer of num_feat values
+        inline void copy_row(sample_t id, featval_t* buffer, feature_t num_feat) const {
+            if (layout == RowLayout::kDense) {
+                std::copy(dense_row(id), dense_row(id) + min(num_feat, static_cast<feature_t>(this->d)), buffer);
+                return;
             }
-            Log::Info("Loaded dataset of size: %d samples x %d features", this->n, this->d);
+            for (size_t k = row_begin[id]; k < row_begin[id + 1] && row_features[k] < num_feat; ++k) {
+                buffer[row_features[k]] = row_values[k];
+            }
+        }
+
+        inline void clear_row(sample_t id, featval_t* buffer) const {
+            for (size_t k = row_begin[id]; k < row_begin[id + 1]; ++k) buffer[row_features[k]] = 0.0;
+        }
+
+        // writes the value of every feature f < num_columns of CSR row i with columns[f] >= 0 to
+        // out[columns[f]], without touching the other entries of out
+        inline void gather_row(sample_t id, const int32_t* columns, feature_t num_columns, featval_t* out) const {
+            for (size_t k = row_begin[id]; k < row_begin[id + 1] && row_features[k] < num_columns; ++k) {
+                if (columns[row_features[k]] >= 0) out[columns[row_features[k]]] = row_values[k];
+            }
+        }
+    };
+
+    /*
+     * Validation or test data binned with the Binner of the training set: one uint8 column per training
+     * feature, so trees are evaluated by comparing bins against Split::bin instead of values against thresholds.
+     */
+    class BinnedDataset: public Dataset{
+    private:
+        vector<vector<bin_t>> columns;
+    public:
+        void load_dataset(const char* data_path, const char* query_path, const Binner* binner) {
+            vector<vector<pair<int, double>>> raw_data;
+            load_data_from_file(data_path, raw_data, this->rank, this->d);
+            this->n = raw_data.size();
+            load_query_from_file(query_path);
+
+            // features the training set does not have are never split on
+            const int num_features = static_cast<int>(binner->thresholds.size());
+            columns.resize(num_features);
+            for (int f = 0; f < num_features; ++f) {
+                columns[f].assign(this->n, binner->value_to_bin(f, 0.0));
+            }
+            for (int i = 0; i < this->n; ++i) {
+                for (auto& entry : raw_data[i]) {
+                    if (entry.first < num_features) columns[entry.first][i] = binner->value_to_bin(entry.first, entry.second);
+                }
+                vector<pair<int, double>>().swap(raw_data[i]);
+            }
+            this->d = num_features;
+            Log::Info("Loaded binned dataset of size: %d samples x %d features", this->n, this->d);
         }
 
-        const vector<double>& get_sample_row(sample_t id) {
-            return data[id];
+        // features the training set does not have read as bin 0, which TreeNode::rebin sends left
+        inline bin_t get_bin(sample_t id, feature_t f) const {
+            return f < columns.size() ? columns[f][id] : 0;
         }
     };
 }
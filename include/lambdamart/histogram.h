@@ -59,13 +59,16 @@ namespace LambdaMART {
 	{
 		feature_t feature;
 		featval_t threshold;
+		bin_t bin = 0;  // values in bins <= bin go left, on data binned by the training Binner
 
 		Split() {}
 		Split(feature_t feature, featval_t threshold) : feature(feature), threshold(threshold) {}
+		Split(feature_t feature, featval_t threshold, bin_t bin) : feature(feature), threshold(threshold), bin(bin) {}
 
 		std::string toString(const std::string& prefix = "")
 		{
-			return prefix + "(feature = " + std::to_string(feature) + ", threshold = " + std::to_string(threshold) + ")";
+			return prefix + "(feature = " + std::to_string(feature) + ", threshold = " + std::to_string(threshold)
+			       + ", bin = " + std::to_string(bin) + ")";
 		}
 	};
 
@@ -128,6 +131,18 @@ namespace LambdaMART {
 
 	typedef Bin NodeStats;
 
+	// histogram bin over quantized gradients: every row counts 1 and adds its integer gradient
+	struct IntBin
+	{
+		int32_t sum_count = 0, sum_gradients = 0;
+
+		inline void update(int32_t gradient)
+		{
+			++sum_count;
+			sum_gradients += gradient;
+		}
+	};
+
 	inline Bin operator-(Bin lhs, const Bin& rhs)
 	{
 		lhs.sum_count -= rhs.sum_count;
@@ -321,7 +336,7 @@ namespace LambdaMART {
 				}
 			}
 
-			Split* bestSplit = new Split(fid, bestThreshold);
+			Split* bestSplit = new Split(fid, bestThreshold, bestThresholdBin);
 			score_t splitGain = bestShiftedGain - totalGain;
 			NodeStats bestLeftInfo(*nodeInfo - bestRightInfo);
 
@@ -614,7 +629,7 @@ namespace LambdaMART {
                                  const sample_t minInstancesPerNode = 1)
 		{
 			const Bin* bins = _head[node];
-			const vector<featval_t>& temp_threshold = feat.threshold;
+			const vector<double>& temp_threshold = feat.threshold;
 
 			score_t totalGain = nodeInfo->getLeafSplitGain();
 
@@ -646,7 +661,7 @@ namespace LambdaMART {
 				}
 			}
 
-			auto* bestSplit = new Split(fid, bestThreshold);
+			auto* bestSplit = new Split(fid, bestThreshold, bestThresholdBin);
 			double splitGain = bestShiftedGain - totalGain;
 
             LOG_TRACE("bestRightInfo: %s", bestRightInfo.toString().c_str());
@@ -11,6 +11,9 @@
 #include <lambdamart/dataset.h>
 #include <lambdamart/booster.h>
 #include <lambdamart/model.h>
+#include <lambdamart/predictor.h>
+#include <lambdamart/compiled.h>
+#include <lambdamart/server.h>
 #include <lambdamart/log.h>
 
 namespace LambdaMART {
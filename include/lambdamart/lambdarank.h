@@ -1,112 +1,147 @@
 #ifndef LAMBDAMART_LAMBDARANK_H
 #define LAMBDAMART_LAMBDARANK_H
 #include <vector>
+#include <cmath>
 #include <lambdamart/types.h>
 #include <lambdamart/config.h>
 #include <lambdamart/dataset.h>
+#include <lambdamart/objective.h>
+#include <lambdamart/random.h>
 
 
 namespace LambdaMART {
 
-class LambdaRank {
-    friend class Booster;
+/*
+ * Metric policies of PairwiseRank. A policy is built once per query (after the documents
+ * are sorted by score) and returns the weight |delta metric| of swapping the documents at
+ * rank positions i and j. Everything is inlined into the pair kernel.
+ */
 
-    public:
-    explicit LambdaRank(Dataset& dataset, Config& config) {
-        boundaries_ = dataset.get_query_boundaries();
-        num_queries_ = dataset.num_queries();
-        label_ = dataset.get_labels();
-        eval_at_ = config.eval_at;
-        //set_eval_rank(&eval_ranks_);
-        set_label_gain(config.max_label);
-        set_discount();
-
-        inverse_max_dcg_.resize(num_queries_);
-        for (int i = 0; i < num_queries_; ++i) {
-            sample_t data_count = boundaries_[i+1] - boundaries_[i];
-            inverse_max_dcg_[i] = cal_maxdcg_k(config.max_position, boundaries_[i], data_count);
-            if (inverse_max_dcg_[i] > 0.0) {
-                inverse_max_dcg_[i] = 1.0f / inverse_max_dcg_[i];
+// NDCG: the classic LambdaRank weight
+struct NDCGDelta {
+    // regularize the pair weight by the score distance
+    static constexpr bool kRegularize = true;
+
+    const real_t* discount;
+    const real_t inverse_max_dcg;
+
+    NDCGDelta(const QueryBlock& query, const real_t* discount, const label_t*, const std::vector<sample_t>&)
+        : discount(discount), inverse_max_dcg(query.inverse_max_dcg) {}
+
+    inline real_t operator()(sample_t i, sample_t j, real_t hl_gain, real_t ll_gain) const {
+        const real_t dcg_gap = hl_gain - ll_gain;
+        const real_t pair_discount = std::fabs(discount[i] - discount[j]);
+        return dcg_gap * pair_discount * inverse_max_dcg;
+    }
+};
+
+// RankNet: every misordered pair has the same weight
+struct UnitDelta {
+    static constexpr bool kRegularize = false;
+
+    UnitDelta(const QueryBlock&, const real_t*, const label_t*, const std::vector<sample_t>&) {}
+
+    inline real_t operator()(sample_t, sample_t, real_t, real_t) const {
+        return 1.0;
+    }
+};
+
+// MAP: change in average precision, with every label > 0 counted as relevant
+struct MAPDelta {
+    static constexpr bool kRegularize = true;
+
+    // relevance of the document at rank position t, number of relevant documents within
+    // positions [0, t] and the sum of 1 / (m + 1) over relevant positions m <= t
+    std::vector<bool> relevant;
+    std::vector<real_t> num_relevant, inverse_rank_sum;
+    real_t inverse_total_relevant = 0.0;
+
+    MAPDelta(const QueryBlock& query, const real_t*, const label_t* label, const std::vector<sample_t>& sindex) {
+        const sample_t count = query.count;
+        relevant.resize(count);
+        num_relevant.resize(count);
+        inverse_rank_sum.resize(count);
+        real_t c = 0.0, s = 0.0;
+        for (sample_t t = 0; t < count; ++t) {
+            relevant[t] = label[sindex[t]] > 0;
+            if (relevant[t]) {
+                c += 1.0;
+                s += real_t(1) / (t + 1);
             }
+            num_relevant[t] = c;
+            inverse_rank_sum[t] = s;
         }
+        if (c > 0.0) inverse_total_relevant = real_t(1) / c;
+    }
 
-        eval_inverse_max_dcg_.resize(num_queries_);
-        for (int i = 0; i < num_queries_; ++i) {
-            eval_inverse_max_dcg_[i].resize(eval_at_.size(), 0.0f);
-            cal_maxdcg(eval_at_, label_+boundaries_[i], boundaries_[i+1] - boundaries_[i], &eval_inverse_max_dcg_[i]);
-            for (int j = 0; j < eval_inverse_max_dcg_[i].size(); ++j) {
-                if (eval_inverse_max_dcg_[i][j] > 0.0f) {
-                    eval_inverse_max_dcg_[i][j] = 1.0f / eval_inverse_max_dcg_[i][j];
-                } else {
-                    eval_inverse_max_dcg_[i][j] = -1.0f;
-                }
-            }
+    inline real_t operator()(sample_t i, sample_t j, real_t, real_t) const {
+        // the high document is relevant; swapping two relevant documents does not change AP
+        if (relevant[j]) return 0.0;
+        real_t delta;
+        if (i < j) {
+            // relevant document moves down from i to j; relevant ones in between lose one hit
+            delta = num_relevant[i] / (i + 1) - num_relevant[j] / (j + 1)
+                    + inverse_rank_sum[j - 1] - inverse_rank_sum[i];
+        } else {
+            // relevant document moves up from i to j; relevant ones in between gain one hit
+            delta = (num_relevant[j] + 1) / (j + 1) - num_relevant[i] / (i + 1)
+                    + inverse_rank_sum[i - 1] - inverse_rank_sum[j];
         }
+        return std::fabs(delta) * inverse_total_relevant;
+    }
+};
 
+/*
+ * Pairwise objectives: lambdas of all pairs with different labels, weighted by Metric.
+ */
+template <typename Metric>
+class PairwiseRank : public Objective {
+    public:
+    explicit PairwiseRank(Dataset& dataset, Config& config) : Objective(dataset, config) {
         create_sigmoid_table();
+
+        pair_sampling_ = config.pair_sampling;
+        pair_sampling_min_query_size_ = config.pair_sampling_min_query_size;
+        pair_sampling_budget_ = config.pair_sampling_budget;
+        seed_ = config.objective_seed;
     }
 
-    void get_derivatives(double* currentScores, double* gradients, double* hessians);
-    void get_derivatives_one_query(double* scores, double* gradients,
-                                    double* hessians, sample_t query_id);
-    std::vector<double> eval(double* scores);
+    void get_derivatives(const score_t* currentScores, gradient_t* gradients, gradient_t* hessians) override;
+    void get_derivatives_one_query(const score_t* scores, gradient_t* gradients,
+                                    gradient_t* hessians, sample_t query_id);
 
     private:
-        const sample_t* boundaries_;
-        sample_t  num_queries_;
-        label_t* label_;
-        std::vector<double> inverse_max_dcg_;
-        std::vector<std::vector<double>> eval_inverse_max_dcg_;
-        // NDCG related fields
-        std::vector<double> label_gain_;
-        std::vector<sample_t> eval_ranks_;
-        std::vector<int> eval_at_;
-        std::vector<double> discount_;
-        // max position of rank
-        int kMaxPosition = 10000;
-
-        std::vector<double> sigmoid_table_;
+        std::vector<gradient_t> sigmoid_table_;
         double min_input_ = -50;
         double max_input_ = 50;
         uint32_t sigmoid_bins_ = 1024*1024;
         double sigmoid_ = 1.0;
         double sig_factor_;
-            
-        void set_eval_rank(std::vector<sample_t>* eval_ranks);
-        void set_label_gain(int max_label); // uses the default of 2^i-1
-        void set_discount();
-
-        //void Init(const std::vector<double>& input_label_gain);
 
-        // Calculates the DCG score at position k, given the rank label and score
-        double cal_dcg_k(int k, const label_t* label, const double* score, sample_t num_data);
+        // stochastic pair sampling for long queries
+        bool pair_sampling_ = false;
+        sample_t pair_sampling_min_query_size_;
+        sample_t pair_sampling_budget_;
+        int seed_;
 
-        // Calculates the DCG score at multiple locations
-        // the result is stored in out. label and score are pointers to
-        // labels and scores respectively
-        void cal_dcg(const std::vector<int>& ks, const label_t* label, const double* score,
-                                            sample_t num_data, std::vector<double>* out);
+        // accumulates the lambda and hessian of one (high, low) pair with metric weight `delta_pair`, scaled by `weight`
+        inline void accumulate_pair(score_t high_score, score_t low_score, real_t delta_pair, bool regularize,
+                                    real_t weight, gradient_t* high_sum_gradient, gradient_t* high_sum_hessian,
+                                    gradient_t* low_gradient, gradient_t* low_hessian) const;
 
-        // calculates the max score (ideal DCG) at position k
-        // returns: max score
-        double cal_maxdcg_k(int k, sample_t start, sample_t num_data);
+        // like get_derivatives_one_query, but each document only visits `pair_sampling_budget_` of its pairs
+        void get_sampled_derivatives_one_query(const score_t* scores, gradient_t* gradients, gradient_t* hessians,
+                                               const std::vector<sample_t>& sindex, const Metric& metric,
+                                               sample_t start, sample_t count, bool regularize, sample_t query_id);
 
-        // calculates the max DCG (ideal DCG), result is stored in out
-        void cal_maxdcg(const std::vector<int>& ks,
-            const label_t* label, sample_t num_data, std::vector<double>* out);
-
-        // checks the label range
-        void check_label(const label_t* label, sample_t num_data);
-
-        // gets discount score at position k
-        inline double get_discount(int k) { return discount_[k]; }
-
-        double get_sigmoid(double score) const;
+        gradient_t get_sigmoid(score_t score) const;
 
         void create_sigmoid_table();
     };
 
-
+typedef PairwiseRank<NDCGDelta> LambdaRank;
+typedef PairwiseRank<UnitDelta> RankNet;
+typedef PairwiseRank<MAPDelta>  LambdaRankMAP;
 
 }
 
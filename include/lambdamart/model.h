@@ -4,8 +4,13 @@
 #include <lambdamart/dataset.h>
 #include <lambdamart/config.h>
 #include <lambdamart/treelearner.h>
-#include <lambdamart/lambdarank.h>
+#include <lambdamart/objective.h>
 #include <lambdamart/types.h>
+#include <lambdamart/writer.h>
+#include <lambdamart/blocked.h>
+
+#include <memory>
+#include <mutex>
 
 namespace LambdaMART {
     class Model {
@@ -13,11 +18,138 @@ namespace LambdaMART {
 
         std::vector<Tree*>  trees;
         std::vector<double> tree_weights;
+        // set by compress and by loading a compressed model: save writes the compact format
+        bool                compact = false;
+        // false for models read from files of version 1, whose splits have no bins
+        bool                has_bins = true;
+
+        void add_tree(Tree* tree, double tree_weight) {
+            trees.push_back(tree);
+            tree_weights.push_back(tree_weight);
+            clear_caches();
+        }
+        // drops all trees after the first num_trees ones
+        void truncate(size_t num_trees);
+        // adds the weighted output of tree m to the running scores of data
+        void add_tree_predictions(size_t m, const RawDataset* data, score_t* scores);
+        void add_tree_predictions(size_t m, const BinnedDataset* data, score_t* scores);
+        // appends the weight and nodes of tree m
+        void serialize_tree(size_t m, std::string* out) const;
+        // compact format of compressed models: the sorted thresholds of every feature, then every tree
+        void serialize_compact(std::string* out) const;
+        static Model* deserialize_compact(const char** p, const char* end);
+
+        // the trees flattened into blocks for predict, see TreeBlock; built on first use
+        vector<TreeBlock> blocks;
+        const vector<TreeBlock>& tree_blocks();
+        // drops what is derived from the trees, after they change
+        void clear_caches() {
+            blocks.clear();
+            std::lock_guard<std::mutex> lock(top_k_mutex);
+            top_k_cache.reset();
+        }
+        // appends the subtree to block and returns its reference; local maps a feature to its index
+        // in block->features, or -1 for features the block does not use yet
+        static int32_t flatten(const Tree* node, vector<int32_t>* local, TreeBlock* block);
 
-        void add_tree(Tree* tree, double tree_weight) { trees.push_back(tree); tree_weights.push_back(tree_weight); }
+        // bounds of the weighted output of trees [m, num_trees) for every m, and a slack that
+        // covers the rounding of scores summed in score_t
+        struct ScoreBounds {
+            vector<double> rest_min, rest_max;
+            double slack;
+        };
+        ScoreBounds score_bounds() const;
+        // what top_k needs from every tree, so that a call for one query does not walk the ensemble;
+        // built on first use, under a lock since top_k is const and may run on several threads
+        struct TopKCache {
+            ScoreBounds bounds;
+            feature_t   num_features;
+        };
+        mutable std::mutex                       top_k_mutex;
+        mutable std::shared_ptr<const TopKCache> top_k_cache;
+        std::shared_ptr<const TopKCache> get_top_k_cache() const;
+        // top_k of one query with rows of num_feat features; prunes with bounds unless it is null
+        vector<sample_t> top_k(const RawDataset* data, sample_t begin, sample_t end, int k, feature_t num_feat,
+                               const ScoreBounds* bounds) const;
     public:
-        vector<double> predict(RawDataset* data, const string& output_path);
-        vector<double> predict(RawDataset* data);
+        // binary format shared by checkpoints and model files: number of trees, then every tree
+        void serialize(std::string* out) const;
+        static Model* deserialize(const char** p, const char* end, uint32_t version);
+
+        // model files use the binary format above
+        void save(const string& path) const;
+        static Model* load(const string& path);
+
+        // writes the ensemble as C++ source with straight-line if/else trees, to be built into a
+        // shared object and loaded by CompiledModel
+        void export_cpp(const string& path) const;
+
+        // post-training compression for inference, in place. Leaf outputs are rounded to float16;
+        // bottom-up, splits of leaves all merged from leaves within prune_tolerance in weighted output
+        // become one leaf, so no score moves by more than prune_tolerance / 2 per tree beyond the float16
+        // rounding, and a split whose two subtrees are identical becomes that subtree. save then writes
+        // splits as their training bin and an index into a table of the thresholds in use, and the
+        // model is scored by the same predictors as any other. Fatal for version 1 models, which have
+        // no bins. Returns the number of splits removed
+        size_t compress(double prune_tolerance);
+
+        size_t num_trees() const { return trees.size(); }
+        // nodes of all trees
+        size_t num_nodes() const;
+        // features the trees split on are all below this index
+        feature_t num_features() const;
+
+        // score of one sample; feature_value(f) returns its value of feature f
+        template <typename FeatureValue>
+        double predict_one(FeatureValue&& feature_value) const {
+            score_t score = 0.0f;
+            for (size_t m = 0; m < trees.size(); ++m) {
+                score += trees[m]->predict_score(feature_value) * tree_weights[m];
+            }
+            return score;
+        }
+
+        // the k best samples of the query [begin, end) of data, best first, ties to the smaller index;
+        // with prune, trees are evaluated in blocks and samples whose score can no longer reach the
+        // top k stop being scored. The result is the same as ranking the scores of predict
+        vector<sample_t> top_k(const RawDataset* data, sample_t begin, sample_t end, int k, bool prune = true) const;
+        // top_k of every query of data
+        vector<vector<sample_t>> top_k(const RawDataset* data, int k, bool prune = true) const;
+
+        // scores of num_rows samples into out, same as predict_one; the trees are walked one at a
+        // time over the whole batch, so each tree is read once per batch instead of once per sample.
+        // feature_value(i, f) returns the value of feature f of sample i
+        template <typename FeatureValue>
+        void predict_batch(size_t num_rows, FeatureValue&& feature_value, double* out) const {
+            vector<score_t> scores(num_rows, 0.0f);
+            for (size_t m = 0; m < trees.size(); ++m) {
+                for (size_t i = 0; i < num_rows; ++i) {
+                    scores[i] += trees[m]->predict_score([&feature_value, i](feature_t f) { return feature_value(i, f); })
+                                 * tree_weights[m];
+                }
+            }
+            std::copy(scores.begin(), scores.end(), out);
+        }
+
+        // gives the splits of a model read from a file of version 1 the bins of their thresholds,
+        // and checks the bins of other models against binner. Returns whether every split is at a
+        // bin boundary of binner, so that data binned by it scores the same as its raw values
+        bool rebin(const Binner& binner);
+
+        // scores raw feature values in the layout the data was loaded with. Samples are tiled by
+        // blocks of trees that fit in L2, and each tile reads the features its trees use from a
+        // buffer that fits in L1; scores are the same as those of predict_rows
+        vector<double> predict(const RawDataset* data, const string& output_path,
+                               ResultFormat format = ResultFormat::kText);
+        vector<double> predict(const RawDataset* data);
+        // scores one sample at a time through all trees
+        vector<double> predict_rows(const RawDataset* data);
+        // scores a training dataset from the raw feature values kept next to its bins
+        vector<double> predict(const Dataset* data);
+        // scores data binned by the training Binner; needs the split bins of the same binning
+        vector<double> predict(const BinnedDataset* data, const string& output_path,
+                               ResultFormat format = ResultFormat::kText);
+        vector<double> predict(const BinnedDataset* data);
     };
 }
 #endif //LAMBDAMART_MODEL_H
\ No newline at end of file
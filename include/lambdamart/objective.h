@@ -0,0 +1,128 @@
+#ifndef LAMBDAMART_OBJECTIVE_H
+#define LAMBDAMART_OBJECTIVE_H
+#include <vector>
+#include <lambdamart/types.h>
+#include <lambdamart/config.h>
+#include <lambdamart/dataset.h>
+
+
+namespace LambdaMART {
+
+// label statistics of one query, computed once at construction
+struct QueryBlock {
+    sample_t start;
+    sample_t count;
+    real_t inverse_max_dcg;
+    // all documents share one label: the query has no pairs and contributes zero gradients
+    bool all_equal_labels;
+};
+
+/*
+ * Base class of the training objectives. It owns the per-query layout of a dataset
+ * and the NDCG evaluation that the booster reports for every objective.
+ * Implementations only provide get_derivatives, which is the one virtual call per iteration.
+ */
+class Objective {
+    public:
+    explicit Objective(Dataset& dataset, Config& config) {
+        boundaries_ = dataset.get_query_boundaries();
+        num_queries_ = dataset.num_queries();
+        label_ = dataset.get_labels();
+        eval_at_ = config.eval_at;
+        //set_eval_rank(&eval_ranks_);
+        set_label_gain(config.max_label);
+        set_discount();
+
+        init_query_blocks(config.max_position);
+
+        eval_inverse_max_dcg_.resize(num_queries_);
+        for (int i = 0; i < num_queries_; ++i) {
+            eval_inverse_max_dcg_[i].resize(eval_at_.size(), 0.0f);
+            cal_maxdcg(eval_at_, label_+boundaries_[i], boundaries_[i+1] - boundaries_[i], &eval_inverse_max_dcg_[i]);
+            for (int j = 0; j < eval_inverse_max_dcg_[i].size(); ++j) {
+                if (eval_inverse_max_dcg_[i][j] > 0.0f) {
+                    eval_inverse_max_dcg_[i][j] = 1.0f / eval_inverse_max_dcg_[i][j];
+                } else {
+                    eval_inverse_max_dcg_[i][j] = -1.0f;
+                }
+            }
+        }
+    }
+
+    virtual ~Objective() = default;
+
+    // creates the objective named by config.objective
+    static Objective* create(Dataset& dataset, Config& config);
+
+    // fills gradients and hessians of all samples for the given scores; both arrays must be
+    // zero on entry, the booster clears them while it applies the previous tree
+    virtual void get_derivatives(const score_t* currentScores, gradient_t* gradients, gradient_t* hessians) = 0;
+
+    // number of finished get_derivatives calls; restored when training resumes
+    uint32_t get_iteration() const { return iter_; }
+    void set_iteration(uint32_t iter) { iter_ = iter; }
+
+    // NDCG at every eval_at position, averaged over queries
+    // the queries are split over an OpenMP team of num_threads threads, all of them when <= 0; the
+    // booster bounds it when evaluating in the background, next to the OpenMP regions of training
+    std::vector<double> eval(const score_t* scores, int num_threads = 0);
+
+    protected:
+        const sample_t* boundaries_;
+        sample_t  num_queries_;
+        label_t* label_;
+        std::vector<QueryBlock> queries_;
+        // label_gain_[label] of every sample, contiguous per query
+        std::vector<real_t> gain_;
+        // number of documents per label, num_labels entries per query
+        std::vector<sample_t> label_counts_;
+        // query ids grouped by descending size class, so large queries are scheduled first
+        std::vector<sample_t> query_order_;
+        std::vector<std::vector<double>> eval_inverse_max_dcg_;
+        // NDCG related fields
+        std::vector<real_t> label_gain_;
+        std::vector<sample_t> eval_ranks_;
+        std::vector<int> eval_at_;
+        std::vector<real_t> discount_;
+        // max position of rank
+        int kMaxPosition = 10000;
+        // number of finished get_derivatives calls, seeds per-iteration randomness
+        uint32_t iter_ = 0;
+
+        void set_eval_rank(std::vector<sample_t>* eval_ranks);
+        void set_label_gain(int max_label); // uses the default of 2^i-1
+        void set_discount();
+        void init_query_blocks(int max_position);
+
+        //void Init(const std::vector<double>& input_label_gain);
+
+        // Sorts the first k entries of sorted_idx by descending score, with ties in index order
+        void sort_top_k(int k, const score_t* score, sample_t num_data, std::vector<int>* sorted_idx);
+
+        // Calculates the DCG score at position k, given the rank label and score
+        double cal_dcg_k(int k, const label_t* label, const score_t* score, sample_t num_data);
+
+        // Calculates the DCG score at multiple locations
+        // the result is stored in out. label and score are pointers to
+        // labels and scores respectively
+        void cal_dcg(const std::vector<int>& ks, const label_t* label, const score_t* score,
+                                            sample_t num_data, std::vector<double>* out);
+
+        // calculates the max score (ideal DCG) at position k
+        // returns: max score
+        double cal_maxdcg_k(int k, sample_t start, sample_t num_data);
+
+        // calculates the max DCG (ideal DCG), result is stored in out
+        void cal_maxdcg(const std::vector<int>& ks,
+            const label_t* label, sample_t num_data, std::vector<double>* out);
+
+        // checks the label range
+        void check_label(const label_t* label, sample_t num_data);
+
+        // gets discount score at position k
+        inline real_t get_discount(int k) const { return discount_[k]; }
+    };
+
+}
+
+#endif //LAMBDAMART_OBJECTIVE_H
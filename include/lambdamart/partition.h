@@ -0,0 +1,97 @@
+#ifndef LAMBDAMART_PARTITION_H
+#define LAMBDAMART_PARTITION_H
+
+#include <lambdamart/types.h>
+#include <vector>
+#include <algorithm>
+
+namespace LambdaMART {
+
+    /*
+     * Sample indices grouped by tree node: the samples of node `id` are the contiguous range
+     * indices[begin(id), begin(id) + count(id)). Splitting a node partitions its range stably,
+     * so each range stays in ascending sample order.
+     *
+     * The rows sampled for the current tree (see set_active) come first in every range, so the
+     * histogram and split code iterate active(id) rows while the score update still walks count(id).
+     */
+    class DataPartition {
+        std::vector<sample_t> indices;
+        std::vector<sample_t> left_buffer, right_buffer;
+        std::vector<sample_t> node_begin, node_count, node_active;
+
+    public:
+        void init(sample_t num_samples, nodeidx_t max_nodes) {
+            indices.resize(num_samples);
+            left_buffer.resize(num_samples);
+            right_buffer.resize(num_samples);
+            for (sample_t i = 0; i < num_samples; ++i) {
+                indices[i] = i;
+            }
+            node_begin.assign(max_nodes, 0);
+            node_count.assign(max_nodes, 0);
+            node_active.assign(max_nodes, 0);
+            node_count[1] = num_samples;
+            node_active[1] = num_samples;
+        }
+
+        // restricts the root to the ascending rows active[0, num_active); the others follow them in order
+        void set_active(const sample_t* active, sample_t num_active) {
+            const sample_t num_samples = static_cast<sample_t>(indices.size());
+            sample_t num_inactive = 0;
+            for (sample_t i = 0, k = 0; i < num_samples; ++i) {
+                if (k < num_active && active[k] == i) {
+                    indices[k++] = i;
+                } else {
+                    right_buffer[num_inactive++] = i;
+                }
+            }
+            std::copy(right_buffer.begin(), right_buffer.begin() + num_inactive, indices.begin() + num_active);
+            node_active[1] = num_active;
+        }
+
+        inline sample_t begin(nodeidx_t node) const { return node_begin[node]; }
+        inline sample_t count(nodeidx_t node) const { return node_count[node]; }
+        inline sample_t active(nodeidx_t node) const { return node_active[node]; }
+        inline const sample_t* data() const { return indices.data(); }
+        inline const sample_t* samples(nodeidx_t node) const { return indices.data() + node_begin[node]; }
+
+        // moves the samples of `node` for which go_left(sample, is_active) holds to child 2*node, the rest to 2*node+1;
+        // splits of different nodes touch disjoint ranges and may run in parallel
+        template <typename GoLeft>
+        void split(nodeidx_t node, GoLeft&& go_left) {
+            const sample_t begin = node_begin[node], count = node_count[node], active = node_active[node];
+            sample_t* left = left_buffer.data() + begin;
+            sample_t* right = right_buffer.data() + begin;
+            sample_t num_left = 0, num_right = 0;
+            for (sample_t k = begin; k < begin + active; ++k) {
+                const sample_t sample = indices[k];
+                if (go_left(sample, true)) {
+                    left[num_left++] = sample;
+                } else {
+                    right[num_right++] = sample;
+                }
+            }
+            const sample_t active_left = num_left, active_right = num_right;
+            for (sample_t k = begin + active; k < begin + count; ++k) {
+                const sample_t sample = indices[k];
+                if (go_left(sample, false)) {
+                    left[num_left++] = sample;
+                } else {
+                    right[num_right++] = sample;
+                }
+            }
+            std::copy(left, left + num_left, indices.begin() + begin);
+            std::copy(right, right + num_right, indices.begin() + begin + num_left);
+            node_begin[node << 1] = begin;
+            node_count[node << 1] = num_left;
+            node_active[node << 1] = active_left;
+            node_begin[(node << 1) + 1] = begin + num_left;
+            node_count[(node << 1) + 1] = num_right;
+            node_active[(node << 1) + 1] = active_right;
+        }
+    };
+
+}
+
+#endif //LAMBDAMART_PARTITION_H
@@ -0,0 +1,42 @@
+#ifndef LAMBDAMART_PREDICTOR_H
+#define LAMBDAMART_PREDICTOR_H
+
+#include <lambdamart/model.h>
+#include <lambdamart/compiled.h>
+#include <lambdamart/config.h>
+#include <lambdamart/writer.h>
+
+#include <string>
+
+namespace LambdaMART {
+
+    /*
+     * Scores a LibSVM file that does not need to fit in memory. The file is mapped and
+     * consumed `predict_chunk_size` rows at a time: the rows of a chunk are parsed and scored
+     * in parallel, each straight into a dense row buffer of its thread, and the scores are
+     * handed to a ResultWriter while the next chunk is parsed. Pages of consumed chunks are
+     * released, so memory stays bounded by the chunk size whatever the size of the file.
+     */
+    class StreamingPredictor {
+    public:
+        StreamingPredictor(const Model* model, const Config* config);
+        StreamingPredictor(const CompiledModel* compiled, const Config* config);
+
+        // writes one score per non-empty row of data_path to output_path, in input order
+        void predict_file(const std::string& data_path, const std::string& output_path);
+
+    private:
+        // exactly one of them scores the rows
+        const Model*         model = nullptr;
+        const CompiledModel* compiled = nullptr;
+        sample_t             chunk_size;
+        feature_t            num_features;
+        ResultFormat         format;
+
+        // scores the rows [row_begin[i], row_end[i]), each followed by a '\n'
+        void predict_chunk(const char* const* row_begin, const char* const* row_end, sample_t num_rows, double* scores) const;
+    };
+
+}
+
+#endif //LAMBDAMART_PREDICTOR_H
@@ -0,0 +1,117 @@
+/*
+ * Pseudo-random number generator.
+ * Modified from LightGBM source code.
+ */
+#ifndef LAMBDAMART_RANDOM_H
+#define LAMBDAMART_RANDOM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace LambdaMART {
+
+/*!
+* \brief A wrapper for random generator. Cheap to construct, so it can live on the stack of a worker thread.
+*/
+    class Random {
+    public:
+        Random() {
+            std::random_device rd;
+            auto generator = std::mt19937(rd());
+            std::uniform_int_distribution<int> distribution(0, x);
+            x = distribution(generator);
+        }
+
+        explicit Random(uint32_t seed) {
+            x = seed;
+        }
+
+        /*!
+        * \brief Generate random integer, int16 range. [0, 65536]
+        * \param lower_bound lower bound
+        * \param upper_bound upper bound
+        * \return The random integer between [lower_bound, upper_bound)
+        */
+        inline int NextShort(int lower_bound, int upper_bound) {
+            return (RandInt16()) % (upper_bound - lower_bound) + lower_bound;
+        }
+
+        /*!
+        * \brief Generate random integer, int32 range
+        * \param lower_bound lower bound
+        * \param upper_bound upper bound
+        * \return The random integer between [lower_bound, upper_bound)
+        */
+        inline int NextInt(int lower_bound, int upper_bound) {
+            return (RandInt32()) % (upper_bound - lower_bound) + lower_bound;
+        }
+
+        /*!
+        * \brief Generate random index from the high bits of the generator; the low bits of an LCG
+        *        modulo 2^32 have short periods, so NextInt with a small range is far from uniform
+        * \param n number of indices
+        * \return The random integer between [0, n)
+        */
+        inline uint32_t NextIndex(uint32_t n) {
+            x = (214013 * x + 2531011);
+            return static_cast<uint32_t>((static_cast<uint64_t>(x) * n) >> 32);
+        }
+
+        /*!
+        * \brief Generate random float data
+        * \return The random float between [0.0, 1.0)
+        */
+        inline float NextFloat() {
+            // get random float in [0,1)
+            return static_cast<float>(RandInt16()) / (32768.0f);
+        }
+
+        /*!
+        * \brief Sample K data from {0,1,...,N-1}
+        * \param N
+        * \param K
+        * \return K Ordered sampled data from {0,1,...,N-1}
+        */
+        std::vector<int> Sample(int N, int K) {
+            std::vector<int> ret;
+            ret.reserve(K);
+            if (K > N || K <= 0) {
+                return ret;
+            } else if (K == N) {
+                for (int i = 0; i < N; ++i) {
+                    ret.push_back(i);
+                }
+            } else {
+                // Floyd's algorithm: every K-subset is equally likely, with K draws
+                std::vector<bool> taken(N, false);
+                for (int j = N - K; j < N; ++j) {
+                    int t = static_cast<int>(NextIndex(static_cast<uint32_t>(j) + 1));
+                    if (taken[t]) t = j;
+                    taken[t] = true;
+                    ret.push_back(t);
+                }
+                std::sort(ret.begin(), ret.end());
+            }
+            return ret;
+        }
+
+    private:
+        inline int RandInt16() {
+            x = (214013 * x + 2531011);
+            return static_cast<int>((x >> 16) & 0x7FFF);
+        }
+
+        inline int RandInt32() {
+            x = (214013 * x + 2531011);
+            return static_cast<int>(x & 0x7FFFFFFF);
+        }
+
+        unsigned int x = 123456789;
+    };
+
+}
+
+#endif //LAMBDAMART_RANDOM_H
@@ -0,0 +1,20 @@
+#ifndef LAMBDAMART_REGRESSION_H
+#define LAMBDAMART_REGRESSION_H
+#include <lambdamart/objective.h>
+
+
+namespace LambdaMART {
+
+/*
+ * Pointwise L2 regression on the labels, as a baseline for the ranking objectives.
+ */
+class Regression : public Objective {
+    public:
+    explicit Regression(Dataset& dataset, Config& config) : Objective(dataset, config) {}
+
+    void get_derivatives(const score_t* currentScores, gradient_t* gradients, gradient_t* hessians) override;
+};
+
+}
+
+#endif //LAMBDAMART_REGRESSION_H
@@ -0,0 +1,84 @@
+#ifndef LAMBDAMART_SERVER_H
+#define LAMBDAMART_SERVER_H
+
+#include <lambdamart/model.h>
+#include <lambdamart/config.h>
+#include <lambdamart/dataset.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <condition_variable>
+
+namespace LambdaMART {
+
+    /*
+     * Wire format of the prediction service, all integers and reals in host byte order:
+     *   request:  uint32 num_rows, uint32 num_features, then num_rows x num_features float32, row-major
+     *   response: uint32 num_rows, then num_rows float64 scores
+     * Features a request does not have read as 0, and those past Model::num_features are read
+     * and dropped. A request has at most serve_batch_size rows, or its connection is closed.
+     * A connection sends its next request after the response to the previous one; a request
+     * of 0 rows is answered with 0 scores.
+     */
+    struct ServeHeader {
+        uint32_t num_rows;
+        uint32_t num_features;
+    };
+
+    /*
+     * Scores requests that arrive on a Unix socket. Every connection has a thread that reads
+     * its requests and queues them; a fixed pool of `serve_threads` workers takes whole
+     * requests off the queue, up to `serve_batch_size` rows at a time, and scores them as one
+     * batch with Model::predict_batch. At most `serve_max_connections` connections are open,
+     * so a connection holds at most serve_batch_size x Model::num_features values.
+     */
+    class PredictionServer {
+    public:
+        PredictionServer(const Model* model, const Config* config);
+        ~PredictionServer();
+
+        PredictionServer(PredictionServer const &) = delete;
+        PredictionServer& operator=(PredictionServer const &) = delete;
+
+        // listens on socket_path until the process is stopped
+        void serve();
+
+    private:
+        struct Request {
+            ServeHeader         header;
+            std::vector<float>  rows;
+            std::vector<double> scores;
+            std::promise<void>  done;
+        };
+
+        const Model*             model;
+        std::string              socket_path;
+        size_t                   batch_size;
+        feature_t                num_features;     // of the model; request values past these are dropped
+        size_t                   max_connections;
+        size_t                   num_connections = 0;
+        std::condition_variable  connection_closed;
+        std::vector<std::thread> workers;
+        std::mutex               mutex;
+        std::condition_variable  cond;
+        std::deque<Request*>     queue;
+        bool                     stopping = false;
+
+        void handle_connection(int fd);
+        void serve_requests(int fd);
+        void close_connection(int fd);
+        void work();
+        void score(const std::vector<Request*>& batch) const;
+    };
+
+    // sends the rows of data to the server at socket_path in batches of `loadgen_batch_size` rows from
+    // `loadgen_connections` connections, `loadgen_requests` requests each, and logs latency and throughput
+    void run_load_generator(const RawDataset* data, const Config* config);
+
+}
+
+#endif //LAMBDAMART_SERVER_H
@@ -5,6 +5,8 @@
 #include <lambdamart/config.h>
 #include <lambdamart/dataset.h>
 #include <lambdamart/histogram.h>
+#include <lambdamart/partition.h>
+#include <lambdamart/random.h>
 #include <queue>
 
 namespace LambdaMART {
@@ -22,6 +24,13 @@ class TreeNode {
         id(id), output(output), impurity(impurity), is_leaf(isLeaf),
         split(nullptr), left_child(nullptr), right_child(nullptr) {}
 
+    // a node owns its split and its subtree
+    ~TreeNode() {
+        delete split;
+        delete left_child;
+        delete right_child;
+    }
+
 private:
     nodeidx_t id;  // root node is 1, left child of x is (2x), right child of x is (2x+1)
     score_t output;
@@ -39,10 +48,32 @@ private:
     }
 
     score_t predict_score(const std::vector<featval_t> &features)
+    {
+        return predict_score([&features](feature_t f) { return features[f]; });
+    }
+
+    // feature_value(f) returns the value of feature f of the sample to score
+    template <typename FeatureValue>
+    score_t predict_score(FeatureValue&& feature_value)
+    {
+        TreeNode* p = this;
+        while (!p->is_leaf) {
+            if (feature_value(p->split->feature) <= p->split->threshold) {
+                p = p->left_child;
+            } else {
+                p = p->right_child;
+            }
+        }
+        return p->output;
+    }
+
+    // feature_bin(f) returns the bin of feature f of the sample to score, binned by the training Binner
+    template <typename FeatureBin>
+    score_t predict_bin_score(FeatureBin&& feature_bin)
     {
         TreeNode* p = this;
         while (!p->is_leaf) {
-            if (features[p->split->feature] <= p->split->threshold) {
+            if (feature_bin(p->split->feature) <= p->split->bin) {
                 p = p->left_child;
             } else {
                 p = p->right_child;
@@ -51,7 +82,250 @@ private:
         return p->output;
     }
 
-    uint32_t get_level() {
+    // appends the subtree as C++ statements: nested if/else on x[feature] that return the leaf outputs
+    void to_cpp(std::string* out, int depth) const
+    {
+        const std::string indent(4 * depth, ' ');
+        if (is_leaf) {
+            *out += indent + "return " + cpp_literal(output) + ";\n";
+            return;
+        }
+        *out += indent + "if (x[" + std::to_string(split->feature) + "] <= " + cpp_literal(split->threshold) + ") {\n";
+        left_child->to_cpp(out, depth + 1);
+        *out += indent + "} else {\n";
+        right_child->to_cpp(out, depth + 1);
+        *out += indent + "}\n";
+    }
+
+    // a literal of type real_t that reads back as exactly `value`
+    static std::string cpp_literal(real_t value)
+    {
+        if (std::isinf(value)) return value > 0 ? "INFINITY" : "-INFINITY";
+        char buffer[40];
+        std::string literal(buffer, Common::ToShortestStr(value, buffer));
+        if (literal.find_first_of(".e") == std::string::npos) literal += ".0";
+        return std::is_same<real_t, float>::value ? literal + "f" : literal;
+    }
+
+    // smallest and largest leaf output of the subtree
+    void leaf_range(score_t* lowest, score_t* highest) const
+    {
+        if (is_leaf) {
+            *lowest = std::min(*lowest, output);
+            *highest = std::max(*highest, output);
+            return;
+        }
+        left_child->leaf_range(lowest, highest);
+        right_child->leaf_range(lowest, highest);
+    }
+
+    // number of features the subtree needs: its largest split feature + 1
+    feature_t num_features() const
+    {
+        if (is_leaf) return 0;
+        return std::max({split->feature + 1, left_child->num_features(), right_child->num_features()});
+    }
+
+    // with assign, sets the bin of every split in the subtree to the bin of binner its threshold
+    // is the upper boundary of; without, checks that the stored bins are those. Returns false when
+    // a split is not at a boundary of binner, where binned data does not score as its raw values
+    bool rebin(const Binner& binner, bool assign)
+    {
+        if (is_leaf) return true;
+        const feature_t f = split->feature;
+        bin_t bin;
+        bool exact = binner.threshold_to_bin(f, split->threshold, &bin);
+        if (assign) {
+            // features the binner does not know are 0 in binned data, which bin 255 sends left
+            split->bin = exact ? bin : f < binner.thresholds.size() ? binner.value_to_bin(f, split->threshold)
+                                                                    : std::numeric_limits<bin_t>::max();
+        } else {
+            exact = exact && bin == split->bin;
+        }
+        const bool left = left_child->rebin(binner, assign);
+        const bool right = right_child->rebin(binner, assign);
+        return exact && left && right;
+    }
+
+    // appends the subtree in pre-order: is_leaf, id, output, impurity, then split and both children;
+    // real numbers are stored as doubles whatever the precision of the build
+    void serialize(std::string* out) const
+    {
+        Common::AppendBinary(out, static_cast<uint8_t>(is_leaf));
+        Common::AppendBinary(out, id);
+        Common::AppendBinary(out, static_cast<double>(output));
+        Common::AppendBinary(out, static_cast<double>(impurity));
+        if (!is_leaf) {
+            Common::AppendBinary(out, split->feature);
+            Common::AppendBinary(out, static_cast<double>(split->threshold));
+            Common::AppendBinary(out, split->bin);
+            left_child->serialize(out);
+            right_child->serialize(out);
+        }
+    }
+
+    // files of version 1 have no split bins; Model::rebin restores them
+    static TreeNode* deserialize(const char** p, const char* end, uint32_t version)
+    {
+        uint8_t leaf;
+        Common::ReadBinary(p, end, &leaf);
+        auto* node = new TreeNode(0);
+        node->is_leaf = leaf != 0;
+        double output, impurity, threshold;
+        Common::ReadBinary(p, end, &node->id);
+        Common::ReadBinary(p, end, &output);
+        Common::ReadBinary(p, end, &impurity);
+        node->output = static_cast<score_t>(output);
+        node->impurity = static_cast<score_t>(impurity);
+        if (!node->is_leaf) {
+            node->split = new Split();
+            Common::ReadBinary(p, end, &node->split->feature);
+            Common::ReadBinary(p, end, &threshold);
+            node->split->threshold = static_cast<featval_t>(threshold);
+            if (version >= 2) Common::ReadBinary(p, end, &node->split->bin);
+            node->left_child = deserialize(p, end, version);
+            node->right_child = deserialize(p, end, version);
+        }
+        return node;
+    }
+
+    // adds the threshold of every split in the subtree to thresholds[feature]
+    void collect_thresholds(std::vector<std::vector<double>>* thresholds) const
+    {
+        if (is_leaf) return;
+        (*thresholds)[split->feature].push_back(split->threshold);
+        left_child->collect_thresholds(thresholds);
+        right_child->collect_thresholds(thresholds);
+    }
+
+    // compact pre-order format of compressed models: is_leaf, then the float16 output of a leaf, or
+    // the feature, bin and uint16 index in the sorted thresholds[feature] of a split. Ids and
+    // impurities are not stored
+    void serialize_compact(const std::vector<std::vector<double>>& thresholds, std::string* out) const
+    {
+        Common::AppendBinary(out, static_cast<uint8_t>(is_leaf));
+        if (is_leaf) {
+            Common::AppendBinary(out, Common::FloatToHalf(static_cast<float>(output)));
+            return;
+        }
+        const std::vector<double>& values = thresholds[split->feature];
+        const size_t index = std::lower_bound(values.begin(), values.end(), split->threshold) - values.begin();
+        Common::AppendBinary(out, split->feature);
+        Common::AppendBinary(out, split->bin);
+        Common::AppendBinary(out, static_cast<uint16_t>(index));
+        left_child->serialize_compact(thresholds, out);
+        right_child->serialize_compact(thresholds, out);
+    }
+
+    static TreeNode* deserialize_compact(const char** p, const char* end, nodeidx_t id,
+                                         const std::vector<std::vector<double>>& thresholds)
+    {
+        uint8_t leaf;
+        Common::ReadBinary(p, end, &leaf);
+        auto* node = new TreeNode(id);
+        node->is_leaf = leaf != 0;
+        if (node->is_leaf) {
+            uint16_t output;
+            Common::ReadBinary(p, end, &output);
+            node->output = Common::HalfToFloat(output);
+            return node;
+        }
+        uint16_t index;
+        node->split = new Split();
+        Common::ReadBinary(p, end, &node->split->feature);
+        Common::ReadBinary(p, end, &node->split->bin);
+        Common::ReadBinary(p, end, &index);
+        if (node->split->feature >= thresholds.size() || index >= thresholds[node->split->feature].size()) {
+            Log::Fatal("Split of an unknown threshold in a compressed model");
+        }
+        node->split->threshold = static_cast<featval_t>(thresholds[node->split->feature][index]);
+        node->left_child = deserialize_compact(p, end, id << 1, thresholds);
+        node->right_child = deserialize_compact(p, end, (id << 1) + 1, thresholds);
+        return node;
+    }
+
+    // rounds every leaf output of the subtree to the nearest float16
+    void round_outputs_to_half()
+    {
+        if (is_leaf) {
+            output = Common::HalfToFloat(Common::FloatToHalf(static_cast<float>(output)));
+            return;
+        }
+        left_child->round_outputs_to_half();
+        right_child->round_outputs_to_half();
+    }
+
+    // whether two subtrees make the same splits and have the same outputs
+    static bool same_subtree(const TreeNode* a, const TreeNode* b)
+    {
+        if (a->is_leaf || b->is_leaf) return a->is_leaf && b->is_leaf && a->output == b->output;
+        return a->split->feature == b->split->feature && a->split->threshold == b->split->threshold
+               && same_subtree(a->left_child, b->left_child) && same_subtree(a->right_child, b->right_child);
+    }
+
+    // bottom-up, replaces a split of two leaves with one leaf when all the leaves the two were merged
+    // from lie within tolerance once multiplied by weight, and a split whose two subtrees are the
+    // same with that subtree. The merged leaf is the midpoint of the leaves it replaces (rounded to
+    // float16 with half), so no score moves by more than tolerance / 2 plus that rounding, however
+    // deep merges cascade. [*lowest, *highest] receives the range of the leaves the subtree was
+    // merged from. Returns the number of splits removed
+    size_t collapse(double weight, double tolerance, bool half, score_t* lowest, score_t* highest)
+    {
+        if (is_leaf) {
+            *lowest = *highest = output;
+            return 0;
+        }
+        score_t left_lowest, left_highest, right_lowest, right_highest;
+        size_t removed = left_child->collapse(weight, tolerance, half, &left_lowest, &left_highest)
+                         + right_child->collapse(weight, tolerance, half, &right_lowest, &right_highest);
+        *lowest = std::min(left_lowest, right_lowest);
+        *highest = std::max(left_highest, right_highest);
+        if (left_child->is_leaf && right_child->is_leaf && std::abs(weight * (*highest - *lowest)) <= tolerance) {
+            score_t mean = (*lowest + *highest) / 2;
+            if (half) mean = Common::HalfToFloat(Common::FloatToHalf(static_cast<float>(mean)));
+            delete split;
+            delete left_child;
+            delete right_child;
+            split = nullptr;
+            left_child = right_child = nullptr;
+            is_leaf = true;
+            output = mean;
+            return removed + 1;
+        }
+        if (same_subtree(left_child, right_child)) {
+            removed += left_child->num_splits() + 1;
+            TreeNode* kept = left_child;
+            delete split;
+            delete right_child;
+            is_leaf = kept->is_leaf;
+            output = kept->output;
+            impurity = kept->impurity;
+            split = kept->split;
+            left_child = kept->left_child;
+            right_child = kept->right_child;
+            kept->split = nullptr;
+            kept->left_child = kept->right_child = nullptr;
+            delete kept;
+            renumber(id);
+        }
+        return removed;
+    }
+
+    size_t num_splits() const
+    {
+        return is_leaf ? 0 : 1 + left_child->num_splits() + right_child->num_splits();
+    }
+
+    // gives the subtree the ids of a subtree rooted at id
+    void renumber(nodeidx_t id)
+    {
+        this->id = id;
+        if (is_leaf) return;
+        left_child->renumber(id << 1);
+        right_child->renumber((id << 1) + 1);
+    }
+
+    uint32_t get_level() const {
         return static_cast<uint32_t>(std::ceil(std::log2(id+1)));
     }
 
@@ -122,7 +396,7 @@ class TreeLearner {
 
 public:
     TreeLearner() = delete;
-    TreeLearner(const Dataset* _dataset, const double* _gradients, const double* _hessians, const Config* _config) :
+    TreeLearner(const Dataset* _dataset, const gradient_t* _gradients, const gradient_t* _hessians, const Config* _config) :
         dataset(_dataset), gradients(_gradients), hessians(_hessians), config(_config)
     {
         tie(num_samples, num_features) = dataset->shape();
@@ -132,8 +406,24 @@ public:
         sample_to_node.resize(num_samples, 0);
         node_to_candidate.resize(1<<(config->max_depth));
         histograms.init(config->max_splits, config->max_bin);
+        if (!dataset->get_bundles().empty()) feature_histograms.init(config->max_splits, config->max_bin);
+        feature_in_level.resize(num_features, false);
+        if (config->max_leaves > 0) init_columns();
+        if (config->goss) row_weights.resize(num_samples, 1.0);
+        quantized = config->quantized_gradients;
+        if (quantized) {
+            quantized_gradients.resize(num_samples);
+            int_histogram.resize(config->max_bin);
+        }
     }
 
+    // builds the tree of boosting iteration `iter` (1-based) on the rows sampled for it
+    Tree* build_new_tree(int iter);
+
+    // adds learning_rate * leaf output to the scores of the samples of every leaf of the last tree,
+    // and clears their gradients and hessians for the next iteration on the way
+    void update_scores(score_t* scores, double learning_rate, gradient_t* gradients_to_clear, gradient_t* hessians_to_clear);
+
 private:
     struct SplitCandidate
     {
@@ -159,35 +449,97 @@ private:
         }
     };
 
+    // a leaf of best-first growth, ordered by the gain of its best split
+    struct LeafCandidate
+    {
+        TreeNode* node;
+        NodeStats* info;
+        SplitInfo best;
+        int slot;  // leaf_histograms slot holding the histograms of the node
+
+        bool operator<(const LeafCandidate& rhs) const
+        {
+            return best.gain < rhs.best.gain || (best.gain == rhs.best.gain && node->id > rhs.node->id);
+        }
+    };
+
+    // bins [offset, offset + num_bins) of a node histogram belong to one feature (bundle < 0) or one bundle
+    struct Column
+    {
+        int feature;
+        int bundle;
+        int num_bins;
+        size_t offset;
+    };
+
     // as input
     const Config*             config;
     const Dataset*            dataset;
-    const double*             gradients;
-    const double*             hessians;
+    const gradient_t*         gradients;
+    const gradient_t*         hessians;
 
     // as working set
     sample_t                            num_samples;
     feature_t                           num_features;
     HistogramMatrix                     histograms;
+    HistogramMatrix                     feature_histograms;  // one feature taken out of a bundle histogram
+    std::vector<bool>                   feature_in_level;
     uint32_t                            cur_depth = 0;
     std::vector<SplitInfo>              best_splits;
     size_t                              max_splits;
     sample_t                            min_data_in_leaf;
-    std::vector<double>                 node_to_output;
+    std::vector<score_t>                node_to_output;
     std::vector<unsigned int>           sample_to_node;
     std::vector<SplitCandidate*>        split_candidates;
     std::vector<NodeStats*>             node_info;
     std::vector<int>                    node_to_candidate;
-    std::vector<int>                    sample_to_candidate;  // -1: this sample doesn't exist in any candidate node
+    DataPartition                       partition;
+    // rows of the current tree in ascending order, empty when all rows are used
+    std::vector<sample_t>               active_rows;
+    // goss weights of the active rows, indexed by sample
+    std::vector<gradient_t>             row_weights;
+    bool                                weighted_rows = false;
+    int                                 bag_iter = 0;  // iteration that drew the current bag
+    int                                 cur_iter = 0;
+    // features considered by the current tree and by its current level
+    std::vector<feature_t>              tree_features, level_features;
+    // gradients of the current tree as integers of gradient_bits bits, in units of gradient_scale
+    bool                                quantized = false;
+    std::vector<int16_t>                quantized_gradients;
+    gradient_t                          gradient_scale = 1.0;
+    std::vector<IntBin>                 int_histogram;
+    // histograms of all columns per splittable leaf, for best-first growth
+    std::vector<Column>                 columns;
+    std::vector<int>                    feature_to_column;
+    std::vector<bool>                   column_in_tree;
+    size_t                              column_bins = 0;
+    std::vector<std::vector<Bin>>       leaf_histograms;
+    std::vector<TreeNode*>              leaves;  // leaves of the last tree
     nodeidx_t                           num_candidates = 0;
     std::priority_queue<SplitCandidate*, std::vector<SplitCandidate*>, CmpCandidates> node_queue;
 
     // tree building methods
-    Tree*  build_new_tree();
+    void   sample_rows(int iter);
+    void   bag_queries(int iter);
+    void   goss_rows(int iter);
+    void   quantize_gradients(int iter);
+    void   sample_features(double fraction, const std::vector<feature_t>& from, uint32_t seed, std::vector<feature_t>* out);
     bool   select_split_candidates();
     void   find_best_splits();
+    void   keep_better_split(SplitInfo* best, const SplitInfo& local_best);
+    template <typename BinType>
+    void   build_histogram(nodeidx_t node, const BinType* bin_index, Bin* hist, int num_bins);
+    void   unbundle_histogram(const FeatureBundle& bundle, size_t k, const Bin* bundle_hist, Bin* out);
     void   perform_split();
-    double get_sample_score(sample_t sid) { return node_to_output[sample_to_node[sid]]; };
+    void   partition_node(nodeidx_t node, SplitInfo& split_info);
+    void   create_children(TreeNode* node, SplitInfo& split_info);
+    // best-first growth
+    void   init_columns();
+    void   build_node_histograms(nodeidx_t node, Bin* out);
+    SplitInfo find_best_split(const Bin* node_histograms, const TreeNode* node, const NodeStats* info);
+    void   grow_leaf_wise(TreeNode* root, NodeStats* root_info);
+    void   collect_leaves(TreeNode* node);
+    score_t get_sample_score(sample_t sid) { return node_to_output[sample_to_node[sid]]; };
 };
 
 }
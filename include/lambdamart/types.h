@@ -9,9 +9,17 @@ namespace LambdaMART {
     typedef uint8_t  bin_t;
     typedef uint16_t label_t;
     typedef uint32_t nodeidx_t;
-    typedef double   score_t; // score of a node
-    typedef double   gradient_t;
-    typedef double   featval_t;
+
+    // precision of scores, gradients, histograms and feature values; the build defines
+    // LAMBDAMART_SINGLE_PRECISION for the float targets (see CMakeLists.txt)
+#ifdef LAMBDAMART_SINGLE_PRECISION
+    typedef float    real_t;
+#else
+    typedef double   real_t;
+#endif
+    typedef real_t   score_t; // score of a node
+    typedef real_t   gradient_t;
+    typedef real_t   featval_t;
 }
 
 #endif //LAMBDAMART_TYPES_H
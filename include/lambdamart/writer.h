@@ -0,0 +1,64 @@
+#ifndef LAMBDAMART_WRITER_H
+#define LAMBDAMART_WRITER_H
+
+#include <lambdamart/types.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace LambdaMART {
+
+    // how a ResultWriter stores scores
+    enum class ResultFormat {
+        kText,    // one score per line, the shortest text that reads back as the same score_t
+        kFloat,   // raw float32 values in host byte order, no header
+        kDouble   // raw float64 values in host byte order, no header
+    };
+
+    // the format named by config.result_format: ``text``, ``float`` or ``double``
+    ResultFormat result_format_from_string(const std::string& name);
+
+    /*
+     * Writes scores to a file on a background thread, in the order they are given. Scores
+     * are formatted into blocks of kBlockSize; at most one block waits behind the one being
+     * written, so a slow disk holds back the caller instead of letting the queue grow.
+     * A failed write is raised with Log::Fatal on the caller's thread, by the next write
+     * or by the destructor.
+     */
+    class ResultWriter {
+    public:
+        static const size_t kBlockSize = 1 << 16;
+
+        ResultWriter(const std::string& path, ResultFormat format);
+
+        // waits until every score is on disk; fatal if any of them could not be written, unless
+        // the stack is already unwinding from another error
+        ~ResultWriter() noexcept(false);
+
+        ResultWriter(ResultWriter const &) = delete;
+        ResultWriter& operator=(ResultWriter const &) = delete;
+
+        void write(const double* scores, size_t num_scores);
+
+    private:
+        std::string             path;
+        ResultFormat            format;
+        FILE*                   file;
+        std::thread             worker;
+        std::mutex              mutex;
+        std::condition_variable cond;
+        std::string             pending;
+        bool                    has_pending = false;
+        bool                    stopping = false;
+        std::string             error;  // of the first failed write, set by the worker
+
+        void submit(std::string&& block);
+        void run();
+    };
+
+}
+
+#endif //LAMBDAMART_WRITER_H
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <filesystem>
 #include <lambdamart/lambdamart.h>
 
 using namespace std;
@@ -13,13 +14,13 @@ void demo(Config* config) {
     auto* X_train = new Dataset(config);
     X_train->load_dataset(train, train_query);
 
-    RawDataset* X_valid = nullptr;
+    BinnedDataset* X_valid = nullptr;
     if (!config->valid_data.empty()) {
         const char* vali = config->valid_data.c_str();
         const char* vali_query = config->valid_query.c_str();
         Log::Info("Loading validation dataset %s and query boundaries %s", vali, vali_query);
-        X_valid = new RawDataset();
-        X_valid->load_dataset(vali, vali_query);
+        X_valid = new BinnedDataset();
+        X_valid->load_dataset(vali, vali_query, X_train->get_binner());
     } else {
         Log::Info("No validation dataset");
     }
@@ -28,8 +29,94 @@ void demo(Config* config) {
     Model* model = (new Booster(X_train, X_valid, config))->train();
     Log::Info("Training finished.");
 
+    Log::Info("Saving model to %s", config->output_model.c_str());
+    model->save(config->output_model);
+
     Log::Info("Predicting with validation dataset and saving output to %s", config->output_result.c_str());
-    vector<double> predictions = model->predict(X_valid, config->output_result);
+    vector<double> predictions = model->predict(X_valid, config->output_result,
+                                                result_format_from_string(config->result_format));
+}
+
+void predict(Config* config) {
+    if (config->predict_data.empty() || (config->input_model.empty() && config->compiled_model.empty())) {
+        Log::Fatal("task = predict needs predict_data and input_model or compiled_model");
+    }
+    if (!config->compiled_model.empty()) {
+        Log::Info("Loading compiled model %s", config->compiled_model.c_str());
+        CompiledModel compiled(config->compiled_model);
+        Log::Info("Predicting %s and saving output to %s", config->predict_data.c_str(), config->output_result.c_str());
+        StreamingPredictor(&compiled, config).predict_file(config->predict_data, config->output_result);
+        return;
+    }
+    Log::Info("Loading model %s", config->input_model.c_str());
+    Model* model = Model::load(config->input_model);
+
+    Log::Info("Predicting %s and saving output to %s", config->predict_data.c_str(), config->output_result.c_str());
+    StreamingPredictor(model, config).predict_file(config->predict_data, config->output_result);
+}
+
+void export_model(Config* config) {
+    if (config->input_model.empty()) {
+        Log::Fatal("task = export needs input_model");
+    }
+    Model* model = Model::load(config->input_model);
+    Log::Info("Writing %lu trees of %s as C++ to %s", model->num_trees(), config->input_model.c_str(),
+              config->output_cpp.c_str());
+    model->export_cpp(config->output_cpp);
+}
+
+void compress(Config* config) {
+    if (config->input_model.empty()) {
+        Log::Fatal("task = compress needs input_model");
+    }
+    Model* model = Model::load(config->input_model);
+    RawDataset* valid = nullptr;
+    vector<double> before;
+    if (!config->valid_data.empty()) {
+        valid = new RawDataset();
+        valid->load_dataset(config->valid_data.c_str(), config->valid_query.c_str(),
+                            row_layout_from_string(config->row_layout));
+        before = model->predict(valid);
+    }
+
+    const size_t num_nodes = model->num_nodes();
+    const size_t removed = model->compress(config->prune_tolerance);
+    Log::Info("Compressed %lu trees from %lu to %lu nodes, %lu splits removed", model->num_trees(), num_nodes,
+              model->num_nodes(), removed);
+    model->save(config->output_model);
+    const auto input_size = std::filesystem::file_size(config->input_model);
+    const auto output_size = std::filesystem::file_size(config->output_model);
+    Log::Info("Saved %s: %lu bytes, %.1f%% of the %lu bytes of %s", config->output_model.c_str(), output_size,
+              100.0 * output_size / input_size, input_size, config->input_model.c_str());
+
+    if (valid) {
+        const vector<double> after = model->predict(valid);
+        Objective* objective = Objective::create(*valid, *config);
+        const vector<score_t> before_scores(before.begin(), before.end()), after_scores(after.begin(), after.end());
+        const vector<double> ndcg_before = objective->eval(before_scores.data());
+        const vector<double> ndcg_after = objective->eval(after_scores.data());
+        for (size_t j = 0; j < config->eval_at.size(); ++j) {
+            Log::Info("valid NDCG@%d: %f -> %f (%+f)", config->eval_at[j], ndcg_before[j], ndcg_after[j],
+                      ndcg_after[j] - ndcg_before[j]);
+        }
+    }
+}
+
+void serve(Config* config) {
+    if (config->input_model.empty()) {
+        Log::Fatal("task = serve needs input_model");
+    }
+    Model* model = Model::load(config->input_model);
+    PredictionServer(model, config).serve();
+}
+
+void loadgen(Config* config) {
+    if (config->predict_data.empty()) {
+        Log::Fatal("task = loadgen needs predict_data");
+    }
+    RawDataset data;
+    data.load_dataset(config->predict_data.c_str(), nullptr, row_layout_from_string(config->row_layout));
+    run_load_generator(&data, config);
 }
 
 int main(int argc, char** argv) {
@@ -43,7 +130,19 @@ int main(int argc, char** argv) {
     Log::Info("Using configuration file %s", argv[1]);
     auto* config = new Config(argv[1]);
 
-    demo(config);
+    if (config->task == "predict") {
+        predict(config);
+    } else if (config->task == "export") {
+        export_model(config);
+    } else if (config->task == "serve") {
+        serve(config);
+    } else if (config->task == "loadgen") {
+        loadgen(config);
+    } else if (config->task == "compress") {
+        compress(config);
+    } else {
+        demo(config);
+    }
 
     return 0;
 }
@@ -0,0 +1,42 @@
+#include <lambdamart/blocked.h>
+
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+namespace LambdaMART {
+
+// size of a data or unified cache of the given level, from the sysfs entries of cpu0
+static size_t sysfs_cache_size(int level) {
+    for (int index = 0; index < 8; ++index) {
+        const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::ifstream level_file(dir + "level"), type_file(dir + "type"), size_file(dir + "size");
+        int cache_level = 0;
+        std::string type, size;
+        if (!(level_file >> cache_level) || !(type_file >> type) || !(size_file >> size)) break;
+        if (cache_level != level || type == "Instruction") continue;
+        size_t bytes = std::stoul(size);
+        if (size.back() == 'K') bytes <<= 10;
+        if (size.back() == 'M') bytes <<= 20;
+        return bytes;
+    }
+    return 0;
+}
+
+const CacheSizes& CacheSizes::get() {
+    static const CacheSizes sizes = [] {
+        CacheSizes s = {0, 0};
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+        s.l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE) > 0 ? sysconf(_SC_LEVEL1_DCACHE_SIZE) : 0;
+        s.l2 = sysconf(_SC_LEVEL2_CACHE_SIZE) > 0 ? sysconf(_SC_LEVEL2_CACHE_SIZE) : 0;
+#endif
+        if (s.l1 == 0) s.l1 = sysfs_cache_size(1);
+        if (s.l2 == 0) s.l2 = sysfs_cache_size(2);
+        if (s.l1 == 0) s.l1 = size_t(32) << 10;
+        if (s.l2 == 0) s.l2 = size_t(1) << 20;
+        return s;
+    }();
+    return sizes;
+}
+
+}
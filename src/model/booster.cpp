@@ -1,29 +1,213 @@
 #include <lambdamart/booster.h>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace LambdaMART {
 
+// "LMCK" in little endian; version 2 stores the model with split bins
+static const uint32_t kCheckpointMagic = 0x4B434D4C;
+static const uint32_t kCheckpointVersion = 2;
+
+void Booster::init_from_model(const std::string& path) {
+    delete model;
+    model = Model::load(path);
+    Log::Info("Continuing training from %s with %lu trees", path.c_str(), model->num_trees());
+    // validation data is binned by the training Binner, which scores a model of another binning wrongly
+    if (!model->rebin(*train_dataset->get_binner()) && valid_dataset) {
+        Log::Fatal("%s splits between the bin boundaries of the training data, so its scores on the binned "
+                   "validation data would be wrong; continue it on the data it was trained on, or without valid_data",
+                   path.c_str());
+    }
+    // trees added by training keep their full precision outputs
+    model->compact = false;
+
+    const std::vector<double> train_predictions = model->predict(train_dataset);
+    current_scores.assign(train_predictions.begin(), train_predictions.end());
+    if (valid_dataset) {
+        const std::vector<double> valid_predictions = model->predict(valid_dataset);
+        valid_scores.assign(valid_predictions.begin(), valid_predictions.end());
+    }
+    if (config->checkpoint_interval > 0) {
+        for (size_t m = 0; m < model->num_trees(); ++m) {
+            model->serialize_tree(m, &serialized_trees);
+        }
+    }
+}
+
+void Booster::start_eval(int iter, bool log) {
+    const bool eval_train = log;
+    const bool eval_valid = valid_dataset != nullptr;
+    if (eval_train) train_snapshot = current_scores;
+    if (eval_valid) valid_snapshot = valid_scores;
+    // the evaluation gets a quarter of the threads, so that it keeps up with the next iteration
+    // without a second full OpenMP team competing with the one of training for the cores
+    int eval_threads = 1;
+#ifdef _OPENMP
+    eval_threads = std::max(1, omp_get_max_threads() / 4);
+#endif
+    pending_eval = std::async(std::launch::async, [this, iter, log, eval_train, eval_valid, eval_threads]() {
+        EvalResult result{iter, log};
+        if (eval_train) result.train = train_objective->eval(train_snapshot.data(), eval_threads);
+        if (eval_valid) result.valid = valid_objective->eval(valid_snapshot.data(), eval_threads);
+        return result;
+    });
+}
+
+bool Booster::finish_eval() {
+    EvalResult result = pending_eval.get();
+    if (result.log)
+        Log::Info("[%d]%s%s", result.iter, get_train_ndcg_string(result.train).c_str(),
+                  valid_dataset ? get_valid_ndcg_string(result.valid).c_str() : "");
+
+    if (config->early_stopping_round > 0 && valid_dataset) {
+        const size_t stopping_idx = std::find(config->eval_at.begin(), config->eval_at.end(),
+                                              config->early_stopping_eval_at) - config->eval_at.begin();
+        if (result.valid[stopping_idx] > best_ndcg) {
+            best_ndcg = result.valid[stopping_idx];
+            best_iter = result.iter;
+        } else if (result.iter - best_iter >= config->early_stopping_round) {
+            Log::Info("Early stopping at iteration %d, the best iteration is [%d]\tvalid-ndcg@%d:%f",
+                      result.iter, best_iter, config->early_stopping_eval_at, best_ndcg);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string Booster::checkpoint_snapshot(int iter) {
+    std::string out;
+    out.reserve(sizeof(double) * (current_scores.size() + valid_scores.size()) + serialized_trees.size() + 64);
+    Common::AppendBinary(&out, kCheckpointMagic);
+    Common::AppendBinary(&out, kCheckpointVersion);
+    Common::AppendBinary(&out, static_cast<int32_t>(iter));
+    Common::AppendBinary(&out, train_objective->get_iteration());
+    Common::AppendBinary(&out, static_cast<int32_t>(best_iter));
+    Common::AppendBinary(&out, best_ndcg);
+    // scores are stored as doubles, so checkpoints do not depend on the precision of the build
+    Common::AppendBinary(&out, std::vector<double>(current_scores.begin(), current_scores.end()));
+    Common::AppendBinary(&out, std::vector<double>(valid_scores.begin(), valid_scores.end()));
+    Common::AppendBinary(&out, static_cast<uint64_t>(model->num_trees()));
+    out.append(serialized_trees);
+    return out;
+}
+
+int Booster::restore_checkpoint(const std::string& path) {
+    ifstream infile(path, ios::binary);
+    if (!infile.is_open()) {
+        Log::Fatal("Cannot open checkpoint %s", path.c_str());
+    }
+    std::string buffer((istreambuf_iterator<char>(infile)), istreambuf_iterator<char>());
+    const char* p = buffer.data();
+    const char* end = p + buffer.size();
+
+    uint32_t magic, version, objective_iter;
+    int32_t iter, saved_best_iter;
+    Common::ReadBinary(&p, end, &magic);
+    Common::ReadBinary(&p, end, &version);
+    if (magic != kCheckpointMagic || version < 1 || version > kCheckpointVersion) {
+        Log::Fatal("%s is not a checkpoint of this version", path.c_str());
+    }
+    Common::ReadBinary(&p, end, &iter);
+    Common::ReadBinary(&p, end, &objective_iter);
+    Common::ReadBinary(&p, end, &saved_best_iter);
+    Common::ReadBinary(&p, end, &best_ndcg);
+    best_iter = saved_best_iter;
+
+    std::vector<double> saved_scores, saved_valid_scores;
+    Common::ReadBinary(&p, end, &saved_scores);
+    Common::ReadBinary(&p, end, &saved_valid_scores);
+    current_scores.assign(saved_scores.begin(), saved_scores.end());
+    if (current_scores.size() != num_samples) {
+        Log::Fatal("Checkpoint %s has %lu training scores, the dataset has %lu samples",
+                   path.c_str(), current_scores.size(), num_samples);
+    }
+    if (valid_dataset) {
+        if (saved_valid_scores.size() != valid_scores.size()) {
+            Log::Fatal("Checkpoint %s does not match the validation dataset", path.c_str());
+        }
+        valid_scores.assign(saved_valid_scores.begin(), saved_valid_scores.end());
+    }
+
+    delete model;
+    model = Model::deserialize(&p, end, version);
+    model->rebin(*train_dataset->get_binner());
+    serialized_trees.clear();
+    if (config->checkpoint_interval > 0) {
+        for (size_t m = 0; m < model->num_trees(); ++m) {
+            model->serialize_tree(m, &serialized_trees);
+        }
+    }
+    train_objective->set_iteration(objective_iter);
+
+    Log::Info("Resumed from checkpoint %s at iteration %d", path.c_str(), iter);
+    return iter;
+}
+
 Model* Booster::train() {
     model = new Model();
+    int start_iter = 0;
+    if (!config->resume_from.empty()) {
+        start_iter = restore_checkpoint(config->resume_from);
+    } else if (!config->input_model.empty()) {
+        init_from_model(config->input_model);
+    }
+    // trees of the input model; iterations count the trees added on top of them
+    const size_t num_init_trees = model->num_trees() - start_iter;
+
+    std::unique_ptr<CheckpointWriter> checkpoint;
+    if (config->checkpoint_interval > 0) {
+        checkpoint.reset(new CheckpointWriter(config->checkpoint_path));
+    }
+
     auto treeLearner = new TreeLearner(train_dataset, gradients.data(), hessians.data(), config);
 
     const int num_iter = config->num_iterations;
     const double learning_rate = config->learning_rate;
     LOG_DEBUG("Train %d iterations with learning rate %lf", num_iter, learning_rate);
 
-    for (int iter = 1; iter <= num_iter; ++iter) {
+    // early stopping watches a single valid-ndcg position
+    const bool early_stopping = config->early_stopping_round > 0 && valid_dataset;
+    if (config->early_stopping_round > 0 && !valid_dataset)
+        Log::Warning("Early stopping needs a validation dataset, training all %d iterations", num_iter);
+
+    bool stopped = false;
+    for (int iter = start_iter + 1; iter <= num_iter; ++iter) {
         LOG_DEBUG("Iteration %d: start", iter);
-        train_ranker->get_derivatives(current_scores.data(), gradients.data(), hessians.data());
+        train_objective->get_derivatives(current_scores.data(), gradients.data(), hessians.data());
 
-        Tree* tree = treeLearner->build_new_tree();
+        Tree* tree = treeLearner->build_new_tree(iter);
         model->add_tree(tree, learning_rate);
+        if (checkpoint) model->serialize_tree(model->num_trees() - 1, &serialized_trees);
 
-        for (sample_t sid = 0; sid < num_samples; ++sid) {
-            current_scores[sid] += learning_rate * treeLearner->get_sample_score(sid);
+        // walks the leaf ranges of the new tree, also clearing the gradients for the next iteration
+        treeLearner->update_scores(current_scores.data(), learning_rate, gradients.data(), hessians.data());
+        // one traversal of the new tree per validation sample instead of re-predicting the whole model
+        if (valid_dataset) model->add_tree_predictions(model->trees.size() - 1, valid_dataset, valid_scores.data());
+
+        // the previous iteration was evaluated while this one computed its gradients and tree;
+        // stopping here costs one extra tree, which the truncation below drops again
+        if (pending_eval.valid() && finish_eval()) {
+            stopped = true;
+            break;
         }
 
-        if (iter % config->eval_interval == 0)
-            Log::Info("[%d]%s%s", iter, get_train_ndcg_string().c_str(), valid_dataset ? get_valid_ndcg_string().c_str() : "");
+        const bool log_eval = iter % config->eval_interval == 0;
+        if (log_eval || early_stopping) start_eval(iter, log_eval);
+
+        if (checkpoint && iter % config->checkpoint_interval == 0) {
+            // a checkpoint carries the early stopping state of its own iteration
+            if (pending_eval.valid() && finish_eval()) {
+                stopped = true;
+                break;
+            }
+            checkpoint->submit(checkpoint_snapshot(iter));
+        }
     }
+    if (!stopped && pending_eval.valid()) finish_eval();
+
+    if (early_stopping) model->truncate(num_init_trees + best_iter);
 
     return model;
 }
@@ -0,0 +1,56 @@
+#include <lambdamart/checkpoint.h>
+
+#include <cstdio>
+
+namespace LambdaMART {
+
+CheckpointWriter::CheckpointWriter(const std::string& path) : path(path) {
+    worker = std::thread(&CheckpointWriter::run, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_one();
+    worker.join();
+}
+
+void CheckpointWriter::submit(std::string&& snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(snapshot);
+        has_pending = true;
+    }
+    cond.notify_one();
+}
+
+void CheckpointWriter::run() {
+    std::string snapshot;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return has_pending || stopping; });
+            if (!has_pending) return;  // stopping, nothing left to write
+            snapshot.swap(pending);
+            has_pending = false;
+        }
+        write(snapshot);
+    }
+}
+
+void CheckpointWriter::write(const std::string& snapshot) {
+    const std::string tmp_path = path + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        Log::Warning("Cannot open checkpoint file %s", tmp_path.c_str());
+        return;
+    }
+    const bool ok = fwrite(snapshot.data(), 1, snapshot.size(), file) == snapshot.size();
+    if (fclose(file) != 0 || !ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        Log::Warning("Failed to write checkpoint %s", path.c_str());
+    }
+}
+
+}
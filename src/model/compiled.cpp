@@ -0,0 +1,60 @@
+#include <lambdamart/compiled.h>
+#include <lambdamart/log.h>
+
+#include <dlfcn.h>
+
+namespace LambdaMART {
+
+CompiledModel::CompiledModel(const std::string& path) {
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        Log::Fatal("Cannot load compiled model %s: %s", path.c_str(), dlerror());
+    }
+    auto num_features_fn = reinterpret_cast<uint32_t (*)()>(dlsym(handle, "lambdamart_num_features"));
+    auto real_bytes_fn = reinterpret_cast<uint32_t (*)()>(dlsym(handle, "lambdamart_real_bytes"));
+    predict_fn = reinterpret_cast<double (*)(const featval_t*)>(dlsym(handle, "lambdamart_predict"));
+    if (num_features_fn == nullptr || real_bytes_fn == nullptr || predict_fn == nullptr) {
+        Log::Fatal("%s is not a compiled LambdaMART model", path.c_str());
+    }
+    if (real_bytes_fn() != sizeof(featval_t)) {
+        Log::Fatal("%s was exported by a build of another precision", path.c_str());
+    }
+    num_feat = num_features_fn();
+}
+
+CompiledModel::~CompiledModel() {
+    dlclose(handle);
+}
+
+std::vector<double> CompiledModel::predict(const RawDataset* data) const {
+    const sample_t num_data = data->num_samples();
+    const feature_t data_feat = data->shape().second;
+    std::vector<double> predictions(num_data);
+    if (data->get_layout() == RowLayout::kDense && data_feat >= num_feat) {
+        #pragma omp parallel for schedule(static)
+        for (sample_t i = 0; i < num_data; ++i) {
+            predictions[i] = predict_fn(data->dense_row(i));
+        }
+        return predictions;
+    }
+
+    // rows are scattered into a buffer that holds every feature of both the data and the model
+    #pragma omp parallel
+    {
+        std::vector<featval_t> row(std::max(num_feat, data_feat), 0.0);
+        #pragma omp for schedule(static)
+        for (sample_t i = 0; i < num_data; ++i) {
+            if (data->get_layout() == RowLayout::kDense) {
+                std::copy(data->dense_row(i), data->dense_row(i) + data_feat, row.begin());
+                predictions[i] = predict_fn(row.data());
+            } else {
+                data->scatter_row(i, row.data());
+                predictions[i] = predict_fn(row.data());
+                data->clear_row(i, row.data());
+            }
+        }
+    }
+    return predictions;
+}
+
+}
@@ -7,30 +7,56 @@
 namespace LambdaMART {
 
 
-void LambdaRank::get_derivatives(double* currentScores, double* gradients, double* hessians) {
+template <typename Metric>
+void PairwiseRank<Metric>::get_derivatives(const score_t* currentScores, gradient_t* gradients, gradient_t* hessians) {
+    // queries write disjoint ranges; large ones go first so the small ones can fill the gaps
+    #pragma omp parallel for schedule(dynamic, 16)
     for (sample_t i = 0; i < num_queries_; ++i) {
-        get_derivatives_one_query(currentScores, gradients, hessians, i);
+        get_derivatives_one_query(currentScores, gradients, hessians, query_order_[i]);
     }
+    ++iter_;
+}
 
+template <typename Metric>
+inline void PairwiseRank<Metric>::accumulate_pair(score_t high_score, score_t low_score, real_t delta_pair, bool regularize,
+                                                  real_t weight, gradient_t* high_sum_gradient, gradient_t* high_sum_hessian,
+                                                  gradient_t* low_gradient, gradient_t* low_hessian) const {
+    const score_t delta = high_score - low_score;
+    gradient_t delta_pair_ndcg = static_cast<gradient_t>(delta_pair);
+    // regularize the pair ndcg by score distance
+    if (regularize) {
+        delta_pair_ndcg /= (0.01f + fabs(delta));
+    }
+    // importance weight of a sampled pair, 1 when all pairs are enumerated
+    delta_pair_ndcg *= static_cast<gradient_t>(weight);
+    // calculate gradient and hessian for this pair
+    gradient_t p_gradient = get_sigmoid(delta);
+    gradient_t p_hessian = p_gradient * (2.0f - p_gradient);
+
+    p_gradient *= delta_pair_ndcg;
+    p_hessian *= 2 * delta_pair_ndcg;
+    *high_sum_gradient += p_gradient;
+    *high_sum_hessian += p_hessian;
+    *low_gradient -= p_gradient;
+    *low_hessian += p_hessian;
 }
 
-inline void LambdaRank::get_derivatives_one_query(double* scores, double* gradients,
-                                        double* hessians, sample_t query_id) {
+template <typename Metric>
+inline void PairwiseRank<Metric>::get_derivatives_one_query(const score_t* scores, gradient_t* gradients,
+                                        gradient_t* hessians, sample_t query_id) {
 
-    const double kminscore = -std::numeric_limits<double>::infinity();
+    const score_t kminscore = -std::numeric_limits<score_t>::infinity();
 
-    const sample_t start = boundaries_[query_id];
-    const sample_t count = boundaries_[query_id+1] - start;
-    const double inverse_max_dcg = inverse_max_dcg_[query_id];
-    //const label_t* label = label_ + start;
+    const QueryBlock& query = queries_[query_id];
+    const sample_t start = query.start;
+    const sample_t count = query.count;
+    const real_t* gain = gain_.data() + start;
     scores += start;
     gradients += start;
     hessians += start;
 
-    for (sample_t i = 0; i < count; ++i) {
-        gradients[i] = 0.0f;
-        hessians[i] = 0.0f;
-    }
+    // gradients and hessians arrive cleared (see Objective::get_derivatives)
+    if (query.all_equal_labels) return;
 
     // get sorted indices for scores;
     std::vector<sample_t> sindex;
@@ -38,69 +64,44 @@ inline void LambdaRank::get_derivatives_one_query(double* scores, double* gradie
         sindex.emplace_back(i);
     }
     std::stable_sort(sindex.begin(), sindex.end(), [scores](sample_t a, sample_t b) {return scores[a] > scores[b]; });
-    double best_score = scores[sindex[0]];
+    score_t best_score = scores[sindex[0]];
     sample_t worst_idx = count - 1;
     if (worst_idx > 0 && scores[sindex[worst_idx]] == kminscore) worst_idx -= 1;
-    const double worst_score = scores[sindex[worst_idx]];
+    const score_t worst_score = scores[sindex[worst_idx]];
+    // pairs always have different labels, so only the score range decides on regularization
+    const bool regularize = Metric::kRegularize && best_score != worst_score;
+
+    const Metric metric(query, discount_.data(), label_ + start, sindex);
+
+    if (pair_sampling_ && count > pair_sampling_min_query_size_) {
+        get_sampled_derivatives_one_query(scores, gradients, hessians, sindex, metric, start, count,
+                                          regularize, query_id);
+        return;
+    }
 
     for (sample_t i = 0; i < count; ++i) {
         const sample_t high = sindex[i];
-        const int high_label = static_cast<int>(label_[start + high]);
-        const double high_score = scores[high];
+        const score_t high_score = scores[high];
         if (high_score == kminscore) {continue; }
-        const double hl_gain = label_gain_[high_label];
-        const double h_discount = get_discount(i);
-        double high_sum_gradient = 0.0;
-        double high_sum_hessian = 0.0;
+        const real_t hl_gain = gain[high];
+        gradient_t high_sum_gradient = 0.0;
+        gradient_t high_sum_hessian = 0.0;
         for (sample_t j = 0; j < count; ++j) {
             if (i == j) continue;
 
             const sample_t low = sindex[j];
-            const int low_label = static_cast<int>(label_[start + low]);
-            const double low_score = scores[low];
-            // only consider pairs with different labels
-            if (high_label <= low_label || low_score == kminscore) continue;
+            const real_t ll_gain = gain[low];
+            const score_t low_score = scores[low];
+            // only consider pairs with different labels (the gain is strictly increasing in the label)
+            if (hl_gain <= ll_gain || low_score == kminscore) continue;
 
-            const double delta = high_score - low_score;
-            const double ll_gain = label_gain_[low_label];
-            const double l_discount = get_discount(j);
-            const double dcg_gap = hl_gain - ll_gain;
-            const double pair_discount = fabs(h_discount - l_discount);
-            double delta_pair_ndcg = dcg_gap * pair_discount * inverse_max_dcg;
-            //std::cout << "delta pair " << dcg_gap << " " << h_discount << " " << l_discount << std::endl;
-            // regularize the pair ndcg by score distance
-            if (high_label != low_label && best_score != worst_score) {
-                delta_pair_ndcg /= (0.01f + fabs(delta));
-            }
-            // calculate gradient and hessian for this pair
-            double p_gradient = get_sigmoid(delta);
-            double p_hessian = p_gradient * (2.0f - p_gradient);
-
-//            p_gradient *= -delta_pair_ndcg;
-            p_gradient *= delta_pair_ndcg;
-            p_hessian *= 2 * delta_pair_ndcg;
-            high_sum_gradient += p_gradient;
-            high_sum_hessian += p_hessian;
-            gradients[low] -= p_gradient;
-            hessians[low] += p_hessian;
+            accumulate_pair(high_score, low_score, metric(i, j, hl_gain, ll_gain), regularize, 1.0,
+                            &high_sum_gradient, &high_sum_hessian, &gradients[low], &hessians[low]);
         }
         gradients[high] += high_sum_gradient;
         hessians[high] += high_sum_hessian;
 
     }
-    double accum = 0.;
-    for (int i = 0; i < count; ++i) {
-        accum += gradients[i] * gradients[i];
-    }
-    double norm = sqrt(accum);
-    double haccum = 0.;
-    for (int i = 0; i < count; ++i) {
-        haccum += hessians[i] * hessians[i];
-    }
-    double hnorm = sqrt(haccum);
-//    std::cout << "Query " << query_id << ": gradient norm: " << norm << " hessian norm: " << hnorm << std::endl;
-//    //std::cout << "score " << scores[0] << " " << scores[1] << " " << scores[2] << " " << scores[3] << " " << scores[4] << std::endl;
-//
 //    std::cout << "score: ";
 //    for (int i = 0; i < count; ++i) {
 //        std::cout << scores[i] << " ";
@@ -109,155 +110,80 @@ inline void LambdaRank::get_derivatives_one_query(double* scores, double* gradie
 
 }
 
-std::vector<double> LambdaRank::eval(double* scores) {
-    std::vector<double> result(eval_at_.size());
-    std::vector<double> tmp_dcg(eval_at_.size(), 0.0f);
-    for (sample_t i = 0; i < num_queries_; ++i) {
-        if (eval_inverse_max_dcg_[i][0] <= 0.0f) {
-            for (int j = 0; j < result.size(); ++j) {
-                result[j] += 1.0f;
-            }
-        } else {
-            sample_t num_data = boundaries_[i+1] - boundaries_[i];
-            cal_dcg(eval_at_, label_ + boundaries_[i], scores + boundaries_[i], num_data, &tmp_dcg);
-            for (int j = 0; j < result.size(); ++j) {
-                result[j] += tmp_dcg[j] * eval_inverse_max_dcg_[i][j];
-            }
+template <typename Metric>
+void PairwiseRank<Metric>::get_sampled_derivatives_one_query(const score_t* scores, gradient_t* gradients, gradient_t* hessians,
+                                                             const std::vector<sample_t>& sindex, const Metric& metric,
+                                                             sample_t start, sample_t count, bool regularize, sample_t query_id) {
+    const score_t kminscore = -std::numeric_limits<score_t>::infinity();
+    const int num_labels = static_cast<int>(label_gain_.size());
+    const real_t* gain = gain_.data() + start;
+
+    // rank positions grouped by ascending label: the partners of a document with label l,
+    // i.e. all documents with a smaller label, are the prefix by_label[0, less_count[l])
+    const sample_t* label_counts = label_counts_.data() + static_cast<size_t>(query_id) * num_labels;
+    std::vector<sample_t> less_count(num_labels + 1, 0);
+    for (int l = 0; l < num_labels; ++l) {
+        less_count[l+1] = less_count[l] + label_counts[l];
+    }
+    std::vector<sample_t> by_label(count);
+    {
+        std::vector<sample_t> next(less_count.begin(), less_count.end() - 1);
+        for (sample_t i = 0; i < count; ++i) {
+            by_label[next[static_cast<int>(label_[start + sindex[i]])]++] = i;
         }
     }
 
-    for (int i = 0; i < eval_at_.size(); ++i) {
-        result[i] /= num_queries_;
-    }
-
-    return result;
-}
+    // the generator lives on this thread's stack and is seeded by (iteration, query),
+    // so the sampled pairs do not depend on how queries are scheduled
+    Random rand(static_cast<uint32_t>(seed_) + iter_ * 2654435761u + query_id * 40503u);
 
-void LambdaRank::set_eval_rank(std::vector<sample_t>* eval_ranks) {
-    if (eval_ranks->empty()) {
-        for (int i = 1; i <= 5; ++i) {
-            eval_ranks->push_back(i);
-        }
-    } else {
-        for (int i = 0; i < eval_ranks->size(); ++i) {
-            // TODO remove later
-            if (!(eval_ranks->at(i) > 0)) {
-                Log::Fatal("Check failed at lambdarank: DefaultEvalRanks");
-                break;
-            }
-        }
-    }
-}
-void LambdaRank::set_label_gain(int max_label) {
-    // relevant gain for labels
-    // label_gain = 2^i - 1, may overflow, so we use 31 here
-    label_gain_.push_back(0.0f);
-    for (int i = 1; i <= max_label; ++i) {
-        label_gain_.push_back(static_cast<double>((1 << i) - 1));
-    }
-    label_gain_.resize(max_label+1);
-}
-
-void LambdaRank::set_discount() {
-    discount_.resize(kMaxPosition);
-    for (int i = 0; i < kMaxPosition; ++i) {
-        discount_[i] = 1.0 / std::log2(2.0 + i);
-    }
-}
-
-double LambdaRank::cal_dcg_k(int k, const label_t* label, const double* score, sample_t num_data) {
-    std::vector<int> sorted_idx(num_data);
-    for (int i = 0; i < num_data; ++i) sorted_idx[i] = i;
-    std::stable_sort(sorted_idx.begin(), sorted_idx.end(), [score](int a, int b)
-            {return score[a] > score[b]; });
-
-    if (k > num_data) k = num_data;
-    double dcg = 0.0f;
-    for (int i = 0; i < k; ++i) {
-        int idx = sorted_idx[i];
-        dcg += label_gain_[static_cast<int>(label[idx])] * discount_[i];
-    }
-    return dcg;
-}
-
-void LambdaRank::cal_dcg(const std::vector<int>& ks, const label_t* label,
-        const double* score, sample_t num_data, std::vector<double>* out) {
-    std::vector<int> sorted_idx(num_data);
-    for (int i = 0; i < num_data; ++i) sorted_idx[i] = i;
-    std::stable_sort(sorted_idx.begin(), sorted_idx.end(),[score](int a, int b)
-        {return score[a] > score[b]; });
-
-    double cur_result = 0.0f;
-    int cur_left = 0;
-    for (int i = 0; i < ks.size(); ++i) {
-        int cur_k = ks[i];
-        if (cur_k > num_data) cur_k = num_data;
-        for (int j = cur_left; j < cur_k; ++j) {
-            int idx = sorted_idx[j];
-            cur_result += label_gain_[static_cast<int>(label[idx])] * discount_[j];
-        }
-        (*out)[i] = cur_result;
-        cur_left = cur_k;
-    }
-}
-
-double LambdaRank::cal_maxdcg_k(int k, sample_t start, sample_t num_data) {
-    double ret = 0.0f;
-    std::vector<int> label_counts(label_gain_.size(), 0);
-    for(int i = 0; i < num_data; ++i) {
-        label_counts[static_cast<int>(label_[start + i])]++;
-    }
-    // top_label has the highest label_gain_
-    int top_label = static_cast<int>(label_gain_.size()) - 1;
-    if (k > num_data) k = num_data;
-    for (int j = 0; j < k; ++j) {
-        while (top_label > 0 && label_counts[top_label] <= 0) {
-            top_label -= 1;
-        }
-        if (top_label < 0) {
-            break;
-        }
-        ret += discount_[j] * label_gain_[top_label];
-        label_counts[top_label] -= 1;
-    }
-    return ret;
-}
-
-void LambdaRank::cal_maxdcg(const std::vector<int>& ks, const label_t* label,
-                            sample_t num_data, std::vector<double>* out) {
-    std::vector<int> label_counts(label_gain_.size(), 0);
-    // get counts for all labels
-    for (int i = 0; i < num_data; ++i) {
-        ++label_counts[static_cast<int>(label[i])];
-    }
-    double cur_result = 0.0f;
-    int cur_left = 0;
-    int top_label = static_cast<int>(label_gain_.size()) - 1;
-    for (int i = 0; i < ks.size(); ++i) {
-        int cur_k = ks[i];
-        if (cur_k > num_data) cur_k = num_data;
-        for (int j = cur_left; j < cur_k; ++j) {
-            while (top_label > 0 && label_counts[top_label] <= 0) {
-                top_label -= 1;
+    for (sample_t i = 0; i < count; ++i) {
+        const sample_t high = sindex[i];
+        const int high_label = static_cast<int>(label_[start + high]);
+        const score_t high_score = scores[high];
+        if (high_score == kminscore) {continue; }
+        const real_t hl_gain = gain[high];
+        const sample_t num_partners = less_count[high_label];
+        gradient_t high_sum_gradient = 0.0;
+        gradient_t high_sum_hessian = 0.0;
+
+        if (num_partners <= pair_sampling_budget_) {
+            // cheap enough to enumerate exactly
+            for (sample_t k = 0; k < num_partners; ++k) {
+                const sample_t j = by_label[k];
+                const sample_t low = sindex[j];
+                const score_t low_score = scores[low];
+                if (low_score == kminscore) continue;
+                accumulate_pair(high_score, low_score, metric(i, j, hl_gain, gain[low]), regularize, 1.0,
+                                &high_sum_gradient, &high_sum_hessian, &gradients[low], &hessians[low]);
             }
-            if (top_label < 0) {
-                break;
+        } else {
+            // draw partners uniformly with replacement; weighting each draw by the inverse of its
+            // probability keeps the expectation equal to the full sum over all partners
+            const real_t weight = static_cast<real_t>(num_partners) / pair_sampling_budget_;
+            for (sample_t k = 0; k < pair_sampling_budget_; ++k) {
+                const sample_t j = by_label[rand.NextIndex(num_partners)];
+                const sample_t low = sindex[j];
+                const score_t low_score = scores[low];
+                if (low_score == kminscore) continue;
+                accumulate_pair(high_score, low_score, metric(i, j, hl_gain, gain[low]), regularize, weight,
+                                &high_sum_gradient, &high_sum_hessian, &gradients[low], &hessians[low]);
             }
-            cur_result += discount_[j] * label_gain_[top_label];
-            label_counts[top_label] -= 1;
         }
-        (*out)[i] = cur_result;
-        cur_left = cur_k;
+        gradients[high] += high_sum_gradient;
+        hessians[high] += high_sum_hessian;
     }
 }
 
-double LambdaRank::get_sigmoid(double score) const {
+template <typename Metric>
+gradient_t PairwiseRank<Metric>::get_sigmoid(score_t score) const {
     if (score <= min_input_) return sigmoid_table_[0];
     else if (score >= max_input_) return sigmoid_table_[sigmoid_bins_-1];
     else return sigmoid_table_[static_cast<uint32_t>((score - min_input_) * sig_factor_)];
 }
 
-void LambdaRank::create_sigmoid_table() {
+template <typename Metric>
+void PairwiseRank<Metric>::create_sigmoid_table() {
     min_input_ = min_input_ / sigmoid_ / 2;
     max_input_ = -min_input_;
     sigmoid_table_.resize(sigmoid_bins_);
@@ -269,4 +195,8 @@ void LambdaRank::create_sigmoid_table() {
     }
 }
 
+template class PairwiseRank<NDCGDelta>;
+template class PairwiseRank<UnitDelta>;
+template class PairwiseRank<MAPDelta>;
+
 }
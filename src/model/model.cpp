@@ -1,41 +1,553 @@
 #include <lambdamart/model.h>
 #include <lambdamart/dataset.h>
 
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace LambdaMART {
 
 
-vector<double> Model::predict(RawDataset* data) {
+// largest number of samples of one parallel task of predict; every tree block is read once per task
+static const sample_t kPredictTaskSamples = 4096;
+
+int32_t Model::flatten(const Tree* node, vector<int32_t>* local, TreeBlock* block) {
+    if (node->is_leaf) {
+        block->leaves.push_back(node->output);
+        return ~static_cast<int32_t>(block->leaves.size() - 1);
+    }
+    const feature_t f = node->split->feature;
+    if ((*local)[f] < 0) {
+        (*local)[f] = static_cast<int32_t>(block->features.size());
+        block->features.push_back(f);
+    }
+    const int32_t n = static_cast<int32_t>(block->nodes.size());
+    block->nodes.push_back({node->split->threshold, static_cast<uint32_t>((*local)[f]), 0, 0});
+    // children are written after their parent, left first, so most steps go to a nearby node
+    const int32_t left = flatten(node->left_child, local, block);
+    const int32_t right = flatten(node->right_child, local, block);
+    block->nodes[n].left = left;
+    block->nodes[n].right = right;
+    return n;
+}
+
+const vector<TreeBlock>& Model::tree_blocks() {
+    if (!blocks.empty() || trees.empty()) return blocks;
+    const CacheSizes& cache = CacheSizes::get();
+    vector<int32_t> local(num_features(), -1);
+    for (size_t m = 0; m < trees.size();) {
+        TreeBlock block;
+        do {
+            block.roots.push_back(flatten(trees[m], &local, &block));
+            block.weights.push_back(tree_weights[m]);
+            ++m;
+        } while (m < trees.size() && block.size_in_bytes() < cache.l2 / 2);
+
+        // features are renumbered in ascending order, so gathering them walks each row forward
+        vector<feature_t> sorted = block.features;
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t j = 0; j < sorted.size(); ++j) local[sorted[j]] = static_cast<int32_t>(j);
+        for (auto& node : block.nodes) node.feature = local[block.features[node.feature]];
+        for (feature_t f : sorted) local[f] = -1;
+        block.features = sorted;
+        block.columns.assign(sorted.empty() ? 0 : sorted.back() + 1, -1);
+        for (size_t j = 0; j < sorted.size(); ++j) block.columns[sorted[j]] = static_cast<int32_t>(j);
+
+        const size_t row_bytes = std::max<size_t>(1, block.features.size()) * sizeof(featval_t);
+        block.block_samples = static_cast<sample_t>(std::min<size_t>(
+            kPredictTaskSamples, std::max<size_t>(16, cache.l1 / 2 / row_bytes)));
+        blocks.push_back(std::move(block));
+    }
+    return blocks;
+}
+
+vector<double> Model::predict(const RawDataset* data) {
+    const vector<TreeBlock>& flat_trees = tree_blocks();
+    const sample_t num_data = data->num_samples();
+    const feature_t num_feat = data->shape().second;
+    const bool dense = data->get_layout() == RowLayout::kDense;
+    vector<score_t> scores(num_data, 0.0f);
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    // every thread gets a task, also when the data is smaller than num_threads full tasks
+    const sample_t task_samples = std::max<sample_t>(1, std::min<sample_t>(
+        kPredictTaskSamples, (num_data + num_threads - 1) / num_threads));
+    const sample_t num_tasks = (num_data + task_samples - 1) / task_samples;
+    #pragma omp parallel
+    {
+        vector<featval_t> values;
+        #pragma omp for schedule(dynamic)
+        for (sample_t task = 0; task < num_tasks; ++task) {
+            const sample_t task_begin = task * task_samples;
+            const sample_t task_end = std::min(num_data, task_begin + task_samples);
+            for (const TreeBlock& block : flat_trees) {
+                const size_t k = block.features.size();
+                values.resize(size_t(block.block_samples) * k);
+                for (sample_t begin = task_begin; begin < task_end; begin += block.block_samples) {
+                    const sample_t end = std::min(task_end, begin + block.block_samples);
+                    // gathers the features of the block for the tile [begin, end), one row after another;
+                    // CSR rows are read once per block, straight into the columns of their features
+                    for (sample_t i = begin; i < end; ++i) {
+                        featval_t* out = values.data() + size_t(i - begin) * k;
+                        if (dense) {
+                            const featval_t* in = data->dense_row(i);
+                            for (size_t j = 0; j < k; ++j) {
+                                out[j] = block.features[j] < num_feat ? in[block.features[j]] : 0.0;
+                            }
+                        } else {
+                            std::fill(out, out + k, 0.0);
+                            data->gather_row(i, block.columns.data(), block.columns.size(), out);
+                        }
+                    }
+                    for (size_t t = 0; t < block.roots.size(); ++t) {
+                        for (sample_t i = begin; i < end; ++i) {
+                            scores[i] += block.predict_tree(t, values.data() + size_t(i - begin) * k) * block.weights[t];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return vector<double>(scores.begin(), scores.end());
+}
+
+vector<double> Model::predict_rows(const RawDataset* data) {
+    size_t num_iter = trees.size();
+    sample_t num_data = data->num_samples();
+    const feature_t num_feat = data->shape().second;
+    vector<double> predictions(num_data);
+    if (data->get_layout() == RowLayout::kDense) {
+        #pragma omp parallel for schedule(static)
+        for (sample_t i = 0; i < num_data; ++i) {
+            const featval_t* row = data->dense_row(i);
+            auto feature_value = [row, num_feat](feature_t f) { return f < num_feat ? row[f] : 0.0; };
+            score_t score = 0.0f;
+            for (size_t m = 0; m < num_iter; ++m) {
+                score += trees[m]->predict_score(feature_value) * tree_weights[m];
+            }
+            predictions[i] = score;
+        }
+        return predictions;
+    }
+
+    // every tree visits the same row, so the row is scattered once into a dense buffer
+    // of this thread and read with direct loads, instead of searching the CSR row per split
+    #pragma omp parallel
+    {
+        vector<featval_t> row(num_feat, 0.0);
+        const featval_t* values = row.data();
+        auto feature_value = [values, num_feat](feature_t f) { return f < num_feat ? values[f] : 0.0; };
+        #pragma omp for schedule(static)
+        for (sample_t i = 0; i < num_data; ++i) {
+            data->scatter_row(i, row.data());
+            score_t score = 0.0f;
+            for (size_t m = 0; m < num_iter; ++m) {
+                score += trees[m]->predict_score(feature_value) * tree_weights[m];
+            }
+            predictions[i] = score;
+            data->clear_row(i, row.data());
+        }
+    }
+    return predictions;
+}
+
+void Model::serialize_tree(size_t m, std::string* out) const {
+    Common::AppendBinary(out, tree_weights[m]);
+    trees[m]->serialize(out);
+}
+
+void Model::serialize(std::string* out) const {
+    Common::AppendBinary(out, static_cast<uint64_t>(trees.size()));
+    for (size_t m = 0; m < trees.size(); ++m) {
+        serialize_tree(m, out);
+    }
+}
+
+Model* Model::deserialize(const char** p, const char* end, uint32_t version) {
+    auto* model = new Model();
+    model->has_bins = version >= 2;
+    uint64_t num_trees;
+    Common::ReadBinary(p, end, &num_trees);
+    for (uint64_t m = 0; m < num_trees; ++m) {
+        double tree_weight;
+        Common::ReadBinary(p, end, &tree_weight);
+        model->add_tree(TreeNode::deserialize(p, end, version), tree_weight);
+    }
+    return model;
+}
+
+void Model::serialize_compact(std::string* out) const {
+    vector<vector<double>> thresholds(num_features());
+    for (const Tree* tree : trees) tree->collect_thresholds(&thresholds);
+    for (auto& values : thresholds) {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        if (values.size() > std::numeric_limits<uint16_t>::max()) {
+            Log::Fatal("Cannot compress a model that splits a feature at more than 65535 thresholds");
+        }
+    }
+    Common::AppendBinary(out, static_cast<uint32_t>(thresholds.size()));
+    for (const auto& values : thresholds) Common::AppendBinary(out, values);
+    Common::AppendBinary(out, static_cast<uint64_t>(trees.size()));
+    for (size_t m = 0; m < trees.size(); ++m) {
+        Common::AppendBinary(out, tree_weights[m]);
+        trees[m]->serialize_compact(thresholds, out);
+    }
+}
+
+Model* Model::deserialize_compact(const char** p, const char* end) {
+    uint32_t num_feat;
+    Common::ReadBinary(p, end, &num_feat);
+    if (num_feat > static_cast<size_t>(end - *p) / sizeof(uint64_t)) {
+        Log::Fatal("Unexpected end of binary data");
+    }
+    vector<vector<double>> thresholds(num_feat);
+    for (auto& values : thresholds) Common::ReadBinary(p, end, &values);
+    auto* model = new Model();
+    model->compact = true;
+    uint64_t num_trees;
+    Common::ReadBinary(p, end, &num_trees);
+    for (uint64_t m = 0; m < num_trees; ++m) {
+        double tree_weight;
+        Common::ReadBinary(p, end, &tree_weight);
+        model->add_tree(TreeNode::deserialize_compact(p, end, 1, thresholds), tree_weight);
+    }
+    return model;
+}
+
+// "LMMD" in little endian; version 2 adds the bin of every split, version 3 is the compact
+// format of compressed models
+static const uint32_t kModelMagic = 0x444D4D4C;
+static const uint32_t kModelVersion = 2;
+static const uint32_t kCompactModelVersion = 3;
+
+void Model::save(const string& path) const {
+    std::string out;
+    Common::AppendBinary(&out, kModelMagic);
+    if (compact) {
+        Common::AppendBinary(&out, kCompactModelVersion);
+        serialize_compact(&out);
+    } else {
+        Common::AppendBinary(&out, kModelVersion);
+        serialize(&out);
+    }
+    ofstream fout(path, ios::binary);
+    if (!fout.is_open()) {
+        Log::Fatal("Cannot open model file %s", path.c_str());
+    }
+    fout.write(out.data(), out.size());
+    fout.close();
+}
+
+Model* Model::load(const string& path) {
+    // the trees are built straight from the mapped file, without a copy of it in memory
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        Log::Fatal("Cannot open model file %s: %s", path.c_str(), std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int error = errno;
+        close(fd);
+        Log::Fatal("Cannot read model file %s: %s", path.c_str(), std::strerror(error));
+    }
+    const size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        Log::Fatal("Model file %s is empty", path.c_str());
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int error = errno;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        Log::Fatal("Cannot map model file %s: %s", path.c_str(), std::strerror(error));
+    }
+    // unmaps the file however loading ends, also when a Fatal error throws
+    struct Mapping {
+        void*  data;
+        size_t size;
+        ~Mapping() { munmap(data, size); }
+    } mapping = {mapped, size};
+
+    const char* p = static_cast<const char*>(mapping.data);
+    const char* end = p + mapping.size;
+    uint32_t magic, version;
+    Common::ReadBinary(&p, end, &magic);
+    Common::ReadBinary(&p, end, &version);
+    if (magic != kModelMagic || version < 1 || version > kCompactModelVersion) {
+        Log::Fatal("%s is not a model file of this version", path.c_str());
+    }
+    return version == kCompactModelVersion ? deserialize_compact(&p, end) : deserialize(&p, end, version);
+}
+
+void Model::export_cpp(const string& path) const {
+    const char* real_type = std::is_same<real_t, float>::value ? "float" : "double";
+    std::string out;
+    out += "// LambdaMART model of " + std::to_string(trees.size()) + " trees, generated by Model::export_cpp\n";
+    out += "// build: c++ -O2 -shared -fPIC " + path + " -o model.so\n";
+    out += "// do not build with -ffast-math: it may reorder the sum of the trees\n\n";
+    out += "#include <cmath>\n#include <cstdint>\n\n";
+    out += "typedef " + std::string(real_type) + " real_t;\n\n";
+    for (size_t m = 0; m < trees.size(); ++m) {
+        out += "static real_t tree_" + std::to_string(m) + "(const real_t* x) {\n";
+        trees[m]->to_cpp(&out, 1);
+        out += "}\n\n";
+    }
+    // the sum is accumulated in the same order and precision as Model::predict_one
+    out += "extern \"C\" {\n\n";
+    out += "uint32_t lambdamart_num_features() { return " + std::to_string(num_features()) + "; }\n\n";
+    out += "uint32_t lambdamart_real_bytes() { return sizeof(real_t); }\n\n";
+    out += "double lambdamart_predict(const real_t* x) {\n    real_t score = 0;\n";
+    char weight[40];
+    for (size_t m = 0; m < trees.size(); ++m) {
+        out += "    score += tree_" + std::to_string(m) + "(x) * "
+               + std::string(weight, Common::ToShortestStr(tree_weights[m], weight)) + ";\n";
+    }
+    out += "    return score;\n}\n\n}\n";
+
+    ofstream fout(path, ios::binary);
+    if (!fout.is_open()) {
+        Log::Fatal("Cannot open file %s", path.c_str());
+    }
+    fout.write(out.data(), out.size());
+    fout.close();
+}
+
+void Model::truncate(size_t num_trees) {
+    for (size_t m = num_trees; m < trees.size(); ++m) {
+        delete trees[m];
+    }
+    if (num_trees < trees.size()) {
+        trees.resize(num_trees);
+        tree_weights.resize(num_trees);
+    }
+    clear_caches();
+}
+
+void Model::add_tree_predictions(size_t m, const RawDataset* data, score_t* scores) {
+    sample_t num_data = data->num_samples();
+    Tree* tree = trees[m];
+    const double tree_weight = tree_weights[m];
+    // a single tree reads a few features per row, so CSR rows are searched instead of scattered
+    #pragma omp parallel for schedule(static)
+    for (sample_t i = 0; i < num_data; ++i) {
+        scores[i] += tree->predict_score([data, i](feature_t f) { return data->get_value(i, f); }) * tree_weight;
+    }
+}
+
+void Model::add_tree_predictions(size_t m, const BinnedDataset* data, score_t* scores) {
+    sample_t num_data = data->num_samples();
+    Tree* tree = trees[m];
+    const double tree_weight = tree_weights[m];
+    #pragma omp parallel for schedule(static)
+    for (sample_t i = 0; i < num_data; ++i) {
+        scores[i] += tree->predict_bin_score([data, i](feature_t f) { return data->get_bin(i, f); }) * tree_weight;
+    }
+}
+
+Model::ScoreBounds Model::score_bounds() const {
+    const size_t num_iter = trees.size();
+    ScoreBounds bounds;
+    bounds.rest_min.assign(num_iter + 1, 0.0);
+    bounds.rest_max.assign(num_iter + 1, 0.0);
+    double magnitude = 1.0;
+    for (size_t m = num_iter; m-- > 0;) {
+        score_t lowest = numeric_limits<score_t>::max(), highest = numeric_limits<score_t>::lowest();
+        trees[m]->leaf_range(&lowest, &highest);
+        const double a = lowest * tree_weights[m], b = highest * tree_weights[m];
+        bounds.rest_min[m] = bounds.rest_min[m + 1] + min(a, b);
+        bounds.rest_max[m] = bounds.rest_max[m + 1] + max(a, b);
+        magnitude += max(fabs(a), fabs(b));
+    }
+    // every partial score is at most `magnitude` in absolute value and takes one rounding per tree
+    bounds.slack = 2.0 * (num_iter + 1) * numeric_limits<score_t>::epsilon() * magnitude;
+    return bounds;
+}
+
+// trees evaluated between two pruning passes
+static const size_t kTopKBlockSize = 16;
+
+std::shared_ptr<const Model::TopKCache> Model::get_top_k_cache() const {
+    std::lock_guard<std::mutex> lock(top_k_mutex);
+    if (!top_k_cache) {
+        top_k_cache = std::make_shared<const TopKCache>(TopKCache{score_bounds(), num_features()});
+    }
+    return top_k_cache;
+}
+
+vector<sample_t> Model::top_k(const RawDataset* data, sample_t begin, sample_t end, int k, feature_t num_feat,
+                              const ScoreBounds* bounds) const {
+    const sample_t count = end - begin;
+    const size_t kk = static_cast<size_t>(min<sample_t>(max(k, 0), count));
+    if (kk == 0) return {};
+    const size_t num_iter = trees.size();
+
+    // the rows of the query are read once per block of trees, so they are made dense once
+    vector<featval_t> rows(static_cast<size_t>(count) * num_feat, 0.0);
+    for (sample_t i = 0; i < count; ++i) {
+        data->copy_row(begin + i, rows.data() + static_cast<size_t>(i) * num_feat, num_feat);
+    }
+
+    vector<score_t> scores(count, 0.0);
+    vector<sample_t> alive(count);
+    for (sample_t i = 0; i < count; ++i) alive[i] = i;
+    vector<double> lower;
+    for (size_t m = 0; m < num_iter; m += kTopKBlockSize) {
+        const size_t stop = min(m + kTopKBlockSize, num_iter);
+        for (sample_t i : alive) {
+            const featval_t* row = rows.data() + static_cast<size_t>(i) * num_feat;
+            auto feature_value = [row](feature_t f) { return row[f]; };
+            // summed in the same order and precision as predict_one
+            score_t score = scores[i];
+            for (size_t t = m; t < stop; ++t) {
+                score += trees[t]->predict_score(feature_value) * tree_weights[t];
+            }
+            scores[i] = score;
+        }
+        if (bounds == nullptr || alive.size() <= kk || stop == num_iter) continue;
+
+        // at least kk samples end at or above the kk-th largest lower bound,
+        // so a sample whose upper bound is below it cannot be in the top k
+        lower.resize(alive.size());
+        for (size_t j = 0; j < alive.size(); ++j) lower[j] = scores[alive[j]] + bounds->rest_min[stop];
+        nth_element(lower.begin(), lower.begin() + (kk - 1), lower.end(), greater<double>());
+        const double threshold = lower[kk - 1] - bounds->slack;
+        const double rest_max = bounds->rest_max[stop] + bounds->slack;
+        alive.erase(remove_if(alive.begin(), alive.end(),
+                              [&](sample_t i) { return scores[i] + rest_max < threshold; }), alive.end());
+    }
+
+    partial_sort(alive.begin(), alive.begin() + kk, alive.end(), [&scores](sample_t a, sample_t b) {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    });
+    vector<sample_t> best(kk);
+    for (size_t j = 0; j < kk; ++j) best[j] = begin + alive[j];
+    return best;
+}
+
+vector<sample_t> Model::top_k(const RawDataset* data, sample_t begin, sample_t end, int k, bool prune) const {
+    const std::shared_ptr<const TopKCache> cache = get_top_k_cache();
+    return top_k(data, begin, end, k, cache->num_features, prune ? &cache->bounds : nullptr);
+}
+
+vector<vector<sample_t>> Model::top_k(const RawDataset* data, int k, bool prune) const {
+    const std::shared_ptr<const TopKCache> cache = get_top_k_cache();
+    const sample_t* boundaries = data->get_query_boundaries();
+    const sample_t num_queries = data->num_queries();
+    vector<vector<sample_t>> best(num_queries);
+    #pragma omp parallel for schedule(dynamic)
+    for (sample_t q = 0; q < num_queries; ++q) {
+        best[q] = top_k(data, boundaries[q], boundaries[q + 1], k, cache->num_features, prune ? &cache->bounds : nullptr);
+    }
+    return best;
+}
+
+size_t Model::compress(double prune_tolerance) {
+    // the compact format stores splits as bins, which version 1 files do not have
+    if (!has_bins) {
+        Log::Fatal("Cannot compress a version 1 model, it has no split bins; continue training it "
+                   "for 0 iterations on its training data to save it as version 2 first");
+    }
+    size_t removed = 0;
+    for (size_t m = 0; m < trees.size(); ++m) {
+        trees[m]->round_outputs_to_half();
+        score_t lowest, highest;
+        removed += trees[m]->collapse(tree_weights[m], prune_tolerance, true, &lowest, &highest);
+    }
+    compact = true;
+    clear_caches();
+    return removed;
+}
+
+size_t Model::num_nodes() const {
+    size_t num_nodes = 0;
+    for (const Tree* tree : trees) num_nodes += 2 * tree->num_splits() + 1;
+    return num_nodes;
+}
+
+feature_t Model::num_features() const {
+    feature_t num_feat = 0;
+    for (const Tree* tree : trees) {
+        num_feat = max(num_feat, tree->num_features());
+    }
+    return num_feat;
+}
+
+bool Model::rebin(const Binner& binner) {
+    bool exact = true;
+    for (Tree* tree : trees) {
+        exact = tree->rebin(binner, !has_bins) && exact;
+    }
+    has_bins = true;
+    return exact;
+}
+
+vector<double> Model::predict(const BinnedDataset* data) {
     size_t num_iter = trees.size();
     sample_t num_data = data->num_samples();
     vector<double> predictions(num_data);
+    #pragma omp parallel for schedule(static)
     for (sample_t i = 0; i < num_data; ++i) {
+        auto feature_bin = [data, i](feature_t f) { return data->get_bin(i, f); };
         score_t score = 0.0f;
         for (size_t m = 0; m < num_iter; ++m) {
-            score += trees[m]->predict_score(data->get_sample_row(i)) * tree_weights[m];
+            score += trees[m]->predict_bin_score(feature_bin) * tree_weights[m];
         }
         predictions[i] = score;
     }
     return predictions;
 }
 
-vector<double> Model::predict(RawDataset* data, const string& output_path) {
+vector<double> Model::predict(const BinnedDataset* data, const string& output_path, ResultFormat format) {
+    vector<double> predictions = predict(data);
+
+    Log::Info("Writing predictions to %s", output_path.c_str());
+    ResultWriter(output_path, format).write(predictions.data(), predictions.size());
+
+    return predictions;
+}
+
+vector<double> Model::predict(const Dataset* data) {
     size_t num_iter = trees.size();
     sample_t num_data = data->num_samples();
+    int num_feat = data->shape().second;
+
+    // scatter the sorted feature values back into sample order, one column per feature
+    vector<vector<featval_t>> columns(num_feat);
+    for (int f = 0; f < num_feat; ++f) {
+        const Feature& feat = data->get_data()[f];
+        columns[f].resize(num_data, 0.0);
+        for (size_t k = 0; k < feat.sample_index.size(); ++k) {
+            columns[f][feat.sample_index[k]] = feat.sample_data[k];
+        }
+    }
+
     vector<double> predictions(num_data);
+    #pragma omp parallel for schedule(static)
     for (sample_t i = 0; i < num_data; ++i) {
+        auto feature_value = [&columns, i](feature_t f) { return f < columns.size() ? columns[f][i] : 0.0; };
         score_t score = 0.0f;
         for (size_t m = 0; m < num_iter; ++m) {
-            score += trees[m]->predict_score(data->get_sample_row(i)) * tree_weights[m];
+            score += trees[m]->predict_score(feature_value) * tree_weights[m];
         }
         predictions[i] = score;
     }
+    return predictions;
+}
+
+vector<double> Model::predict(const RawDataset* data, const string& output_path, ResultFormat format) {
+    vector<double> predictions = predict(data);
 
     Log::Info("Writing predictions to %s", output_path.c_str());
-    ofstream fout(output_path);
-    for (score_t score: predictions) {
-        fout << score << '\n';
-    }
-    fout.close();
+    ResultWriter(output_path, format).write(predictions.data(), predictions.size());
 
     return predictions;
 }
@@ -0,0 +1,233 @@
+#include <lambdamart/objective.h>
+#include <lambdamart/lambdarank.h>
+#include <lambdamart/regression.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace LambdaMART {
+
+
+Objective* Objective::create(Dataset& dataset, Config& config) {
+    const string& name = config.objective;
+    if (name == "lambdarank") {
+        return new LambdaRank(dataset, config);
+    } else if (name == "ranknet") {
+        return new RankNet(dataset, config);
+    } else if (name == "lambdarank_map") {
+        return new LambdaRankMAP(dataset, config);
+    } else if (name == "regression") {
+        return new Regression(dataset, config);
+    }
+    Log::Fatal("Unknown objective %s", name.c_str());
+    return nullptr;
+}
+
+void Objective::init_query_blocks(int max_position) {
+    const int num_labels = static_cast<int>(label_gain_.size());
+    queries_.resize(num_queries_);
+    gain_.resize(boundaries_[num_queries_]);
+    label_counts_.assign(static_cast<size_t>(num_queries_) * num_labels, 0);
+
+    for (sample_t i = 0; i < num_queries_; ++i) {
+        QueryBlock& query = queries_[i];
+        query.start = boundaries_[i];
+        query.count = boundaries_[i+1] - boundaries_[i];
+        query.inverse_max_dcg = cal_maxdcg_k(max_position, query.start, query.count);
+        if (query.inverse_max_dcg > 0.0) {
+            query.inverse_max_dcg = 1.0f / query.inverse_max_dcg;
+        }
+
+        sample_t* counts = label_counts_.data() + static_cast<size_t>(i) * num_labels;
+        int num_distinct = 0;
+        for (sample_t k = query.start; k < query.start + query.count; ++k) {
+            const int label = static_cast<int>(label_[k]);
+            gain_[k] = label_gain_[label];
+            num_distinct += counts[label]++ == 0;
+        }
+        query.all_equal_labels = num_distinct <= 1;
+    }
+
+    // size class = floor(log2(count)); stable within a class to keep the order predictable
+    auto size_class = [](sample_t count) {
+        int c = 0;
+        while (count >>= 1) ++c;
+        return c;
+    };
+    query_order_.resize(num_queries_);
+    for (sample_t i = 0; i < num_queries_; ++i) query_order_[i] = i;
+    std::stable_sort(query_order_.begin(), query_order_.end(), [&](sample_t a, sample_t b) {
+        return size_class(queries_[a].count) > size_class(queries_[b].count);
+    });
+}
+
+std::vector<double> Objective::eval(const score_t* scores, int num_threads) {
+#ifdef _OPENMP
+    if (num_threads <= 0) num_threads = omp_get_max_threads();
+#endif
+    const size_t num_eval = eval_at_.size();
+    // per-query results, reduced serially in query order so the sum does not depend on the schedule
+    std::vector<double> query_ndcg(static_cast<size_t>(num_queries_) * num_eval);
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(num_threads)
+    for (sample_t i = 0; i < num_queries_; ++i) {
+        double* out = query_ndcg.data() + static_cast<size_t>(i) * num_eval;
+        if (eval_inverse_max_dcg_[i][0] <= 0.0f) {
+            for (size_t j = 0; j < num_eval; ++j) {
+                out[j] = 1.0f;
+            }
+        } else {
+            std::vector<double> tmp_dcg(num_eval, 0.0f);
+            sample_t num_data = boundaries_[i+1] - boundaries_[i];
+            cal_dcg(eval_at_, label_ + boundaries_[i], scores + boundaries_[i], num_data, &tmp_dcg);
+            for (size_t j = 0; j < num_eval; ++j) {
+                out[j] = tmp_dcg[j] * eval_inverse_max_dcg_[i][j];
+            }
+        }
+    }
+
+    std::vector<double> result(num_eval);
+    for (sample_t i = 0; i < num_queries_; ++i) {
+        const double* out = query_ndcg.data() + static_cast<size_t>(i) * num_eval;
+        for (size_t j = 0; j < num_eval; ++j) {
+            result[j] += out[j];
+        }
+    }
+
+    for (int i = 0; i < eval_at_.size(); ++i) {
+        result[i] /= num_queries_;
+    }
+
+    return result;
+}
+
+void Objective::set_eval_rank(std::vector<sample_t>* eval_ranks) {
+    if (eval_ranks->empty()) {
+        for (int i = 1; i <= 5; ++i) {
+            eval_ranks->push_back(i);
+        }
+    } else {
+        for (int i = 0; i < eval_ranks->size(); ++i) {
+            // TODO remove later
+            if (!(eval_ranks->at(i) > 0)) {
+                Log::Fatal("Check failed at lambdarank: DefaultEvalRanks");
+                break;
+            }
+        }
+    }
+}
+void Objective::set_label_gain(int max_label) {
+    // relevant gain for labels
+    // label_gain = 2^i - 1, may overflow, so we use 31 here
+    label_gain_.push_back(0.0f);
+    for (int i = 1; i <= max_label; ++i) {
+        label_gain_.push_back(static_cast<real_t>((1 << i) - 1));
+    }
+    label_gain_.resize(max_label+1);
+}
+
+void Objective::set_discount() {
+    discount_.resize(kMaxPosition);
+    for (int i = 0; i < kMaxPosition; ++i) {
+        discount_[i] = 1.0 / std::log2(2.0 + i);
+    }
+}
+
+void Objective::sort_top_k(int k, const score_t* score, sample_t num_data, std::vector<int>* sorted_idx) {
+    sorted_idx->resize(num_data);
+    for (int i = 0; i < num_data; ++i) (*sorted_idx)[i] = i;
+    // ties are broken by index, which gives the same prefix as a full stable_sort
+    auto cmp = [score](int a, int b) { return score[a] > score[b] || (score[a] == score[b] && a < b); };
+    if (k >= static_cast<int>(num_data)) {
+        std::sort(sorted_idx->begin(), sorted_idx->end(), cmp);
+    } else if (k > 0) {
+        std::partial_sort(sorted_idx->begin(), sorted_idx->begin() + k, sorted_idx->end(), cmp);
+    }
+}
+
+double Objective::cal_dcg_k(int k, const label_t* label, const score_t* score, sample_t num_data) {
+    if (k > num_data) k = num_data;
+    std::vector<int> sorted_idx;
+    sort_top_k(k, score, num_data, &sorted_idx);
+
+    double dcg = 0.0f;
+    for (int i = 0; i < k; ++i) {
+        int idx = sorted_idx[i];
+        dcg += label_gain_[static_cast<int>(label[idx])] * discount_[i];
+    }
+    return dcg;
+}
+
+void Objective::cal_dcg(const std::vector<int>& ks, const label_t* label,
+        const score_t* score, sample_t num_data, std::vector<double>* out) {
+    // only the top max(ks) positions are ever read
+    std::vector<int> sorted_idx;
+    sort_top_k(*std::max_element(ks.begin(), ks.end()), score, num_data, &sorted_idx);
+
+    double cur_result = 0.0f;
+    int cur_left = 0;
+    for (int i = 0; i < ks.size(); ++i) {
+        int cur_k = ks[i];
+        if (cur_k > num_data) cur_k = num_data;
+        for (int j = cur_left; j < cur_k; ++j) {
+            int idx = sorted_idx[j];
+            cur_result += label_gain_[static_cast<int>(label[idx])] * discount_[j];
+        }
+        (*out)[i] = cur_result;
+        cur_left = cur_k;
+    }
+}
+
+double Objective::cal_maxdcg_k(int k, sample_t start, sample_t num_data) {
+    double ret = 0.0f;
+    std::vector<int> label_counts(label_gain_.size(), 0);
+    for(int i = 0; i < num_data; ++i) {
+        label_counts[static_cast<int>(label_[start + i])]++;
+    }
+    // top_label has the highest label_gain_
+    int top_label = static_cast<int>(label_gain_.size()) - 1;
+    if (k > num_data) k = num_data;
+    for (int j = 0; j < k; ++j) {
+        while (top_label > 0 && label_counts[top_label] <= 0) {
+            top_label -= 1;
+        }
+        if (top_label < 0) {
+            break;
+        }
+        ret += discount_[j] * label_gain_[top_label];
+        label_counts[top_label] -= 1;
+    }
+    return ret;
+}
+
+void Objective::cal_maxdcg(const std::vector<int>& ks, const label_t* label,
+                            sample_t num_data, std::vector<double>* out) {
+    std::vector<int> label_counts(label_gain_.size(), 0);
+    // get counts for all labels
+    for (int i = 0; i < num_data; ++i) {
+        ++label_counts[static_cast<int>(label[i])];
+    }
+    double cur_result = 0.0f;
+    int cur_left = 0;
+    int top_label = static_cast<int>(label_gain_.size()) - 1;
+    for (int i = 0; i < ks.size(); ++i) {
+        int cur_k = ks[i];
+        if (cur_k > num_data) cur_k = num_data;
+        for (int j = cur_left; j < cur_k; ++j) {
+            while (top_label > 0 && label_counts[top_label] <= 0) {
+                top_label -= 1;
+            }
+            if (top_label < 0) {
+                break;
+            }
+            cur_result += discount_[j] * label_gain_[top_label];
+            label_counts[top_label] -= 1;
+        }
+        (*out)[i] = cur_result;
+        cur_left = cur_k;
+    }
+}
+
+}
@@ -0,0 +1,130 @@
+#include <lambdamart/predictor.h>
+#include <lambdamart/common.h>
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LambdaMART {
+
+StreamingPredictor::StreamingPredictor(const Model* model, const Config* config)
+    : model(model), chunk_size(config->predict_chunk_size), num_features(model->num_features()),
+      format(result_format_from_string(config->result_format)) {}
+
+StreamingPredictor::StreamingPredictor(const CompiledModel* compiled, const Config* config)
+    : compiled(compiled), chunk_size(config->predict_chunk_size), num_features(compiled->num_features()),
+      format(result_format_from_string(config->result_format)) {}
+
+// calls emit(feature, value) for every "index:value" of the row [p, end) that ends in '\n';
+// the label and tokens like "qid:1" are skipped
+template <typename Emit>
+static inline void parse_row(const char* p, const char* end, Emit&& emit) {
+    while (p < end && *p != ' ' && *p != '\t') ++p;
+    while (true) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        if (p >= end) return;
+        if (*p >= '0' && *p <= '9') {
+            uint32_t index = 0;
+            for (; *p >= '0' && *p <= '9'; ++p) index = index * 10 + (*p - '0');
+            if (*p == ':' && index > 0) {
+                double value;
+                p = Common::Atof(p + 1, &value);
+                // the training parser reads values as float
+                emit(index - 1, static_cast<float>(value));
+                continue;
+            }
+        }
+        while (p < end && *p != ' ' && *p != '\t') ++p;
+    }
+}
+
+void StreamingPredictor::predict_chunk(const char* const* row_begin, const char* const* row_end, sample_t num_rows,
+                                       double* scores) const {
+    const feature_t num_feat = num_features;
+    #pragma omp parallel
+    {
+        // features beyond num_features are never split on and are not stored
+        std::vector<featval_t> row(num_feat, 0.0);
+        std::vector<feature_t> touched;
+        featval_t* values = row.data();
+        auto feature_value = [values](feature_t f) { return values[f]; };
+        #pragma omp for schedule(static)
+        for (sample_t i = 0; i < num_rows; ++i) {
+            parse_row(row_begin[i], row_end[i], [values, num_feat, &touched](feature_t f, featval_t v) {
+                if (f < num_feat) {
+                    values[f] = v;
+                    touched.push_back(f);
+                }
+            });
+            scores[i] = compiled ? compiled->predict_row(values) : model->predict_one(feature_value);
+            for (feature_t f : touched) values[f] = 0.0;
+            touched.clear();
+        }
+    }
+}
+
+void StreamingPredictor::predict_file(const std::string& data_path, const std::string& output_path) {
+    const int fd = open(data_path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        Log::Fatal("Cannot open file %s", data_path.c_str());
+    }
+    const size_t size = st.st_size;
+    const char* data = nullptr;
+    if (size > 0) {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            Log::Fatal("Cannot map file %s", data_path.c_str());
+        }
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    ResultWriter writer(output_path, format);
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    std::vector<const char*> row_begin(chunk_size), row_end(chunk_size);
+    std::vector<double> scores(chunk_size);
+    // a last row without '\n' is copied, so the parser can rely on the terminator
+    std::string last_row;
+    size_t pos = 0, released = 0, total = 0;
+    while (pos < size) {
+        sample_t num_rows = 0;
+        while (num_rows < chunk_size && pos < size) {
+            const char* begin = data + pos;
+            const char* newline = static_cast<const char*>(memchr(begin, '\n', size - pos));
+            const char* end = newline ? newline : data + size;
+            pos = end - data + 1;
+            const char* p = begin;
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            if (p == end) continue;
+            if (newline == nullptr) {
+                last_row.assign(begin, end);
+                last_row.push_back('\n');
+                begin = last_row.data();
+                end = begin + last_row.size() - 1;
+            }
+            row_begin[num_rows] = begin;
+            row_end[num_rows] = end;
+            ++num_rows;
+        }
+        if (num_rows == 0) break;
+        predict_chunk(row_begin.data(), row_end.data(), num_rows, scores.data());
+
+        writer.write(scores.data(), num_rows);
+        total += num_rows;
+
+        // drop the pages of the rows already scored
+        const size_t release_end = std::min(pos, size) / page_size * page_size;
+        if (release_end > released) {
+            madvise(const_cast<char*>(data) + released, release_end - released, MADV_DONTNEED);
+            released = release_end;
+        }
+    }
+    if (data != nullptr) munmap(const_cast<char*>(data), size);
+    Log::Info("Wrote %lu predictions to %s", total, output_path.c_str());
+}
+
+}
@@ -0,0 +1,18 @@
+#include <lambdamart/regression.h>
+
+namespace LambdaMART {
+
+
+void Regression::get_derivatives(const score_t* currentScores, gradient_t* gradients, gradient_t* hessians) {
+    const sample_t num_data = boundaries_[num_queries_];
+    #pragma omp parallel for schedule(static)
+    for (sample_t i = 0; i < num_data; ++i) {
+        // gradients point in the direction of improvement, like the lambdas
+        gradients[i] = static_cast<gradient_t>(label_[i]) - currentScores[i];
+        // the leaf output is sum(gradients) / (2 * sum(hessians)), so this yields the mean residual
+        hessians[i] = static_cast<gradient_t>(0.5);
+    }
+    ++iter_;
+}
+
+}
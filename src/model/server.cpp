@@ -0,0 +1,285 @@
+#include <lambdamart/server.h>
+#include <lambdamart/log.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace LambdaMART {
+
+static bool read_full(int fd, void* buffer, size_t size) {
+    char* p = static_cast<char*>(buffer);
+    while (size > 0) {
+        const ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// reads and drops size bytes
+static bool skip_full(int fd, size_t size) {
+    char buffer[4096];
+    while (size > 0) {
+        const size_t n = std::min(size, sizeof(buffer));
+        if (!read_full(fd, buffer, n)) return false;
+        size -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buffer, size_t size) {
+    const char* p = static_cast<const char*>(buffer);
+    while (size > 0) {
+        const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        Log::Fatal("Socket path %s is too long", path.c_str());
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+PredictionServer::PredictionServer(const Model* model, const Config* config)
+    : model(model), socket_path(config->socket_path), batch_size(config->serve_batch_size),
+      num_features(model->num_features()), max_connections(config->serve_max_connections) {
+    int num_threads = config->serve_threads;
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 0; t < num_threads; ++t) {
+        workers.emplace_back(&PredictionServer::work, this);
+    }
+}
+
+PredictionServer::~PredictionServer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void PredictionServer::serve() {
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    const sockaddr_un address = socket_address(socket_path);
+    unlink(socket_path.c_str());
+    if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0) {
+        Log::Fatal("Cannot listen on %s: %s", socket_path.c_str(), std::strerror(errno));
+    }
+    Log::Info("Serving %lu trees on %s with %lu workers", model->num_trees(), socket_path.c_str(), workers.size());
+    while (true) {
+        {
+            // connections beyond the limit wait in the listen backlog
+            std::unique_lock<std::mutex> lock(mutex);
+            connection_closed.wait(lock, [this] { return num_connections < max_connections; });
+        }
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            Log::Fatal("Cannot accept connections on %s: %s", socket_path.c_str(), std::strerror(errno));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++num_connections;
+        }
+        try {
+            std::thread(&PredictionServer::handle_connection, this, fd).detach();
+        } catch (const std::system_error& e) {
+            Log::Warning("Cannot start a thread for a connection: %s", e.what());
+            close_connection(fd);
+        }
+    }
+}
+
+void PredictionServer::close_connection(int fd) {
+    close(fd);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --num_connections;
+    }
+    connection_closed.notify_one();
+}
+
+// reads the rows of a request whose header is read, keeping the first stored_features values of each
+static bool read_rows(int fd, uint32_t num_rows, uint32_t num_features, uint32_t stored_features, float* out) {
+    if (stored_features == num_features) {
+        return read_full(fd, out, size_t(num_rows) * num_features * sizeof(float));
+    }
+    for (uint32_t r = 0; r < num_rows; ++r) {
+        if (!read_full(fd, out + size_t(r) * stored_features, stored_features * sizeof(float))
+            || !skip_full(fd, size_t(num_features - stored_features) * sizeof(float))) return false;
+    }
+    return true;
+}
+
+void PredictionServer::handle_connection(int fd) {
+    try {
+        serve_requests(fd);
+    } catch (const std::bad_alloc&) {
+        Log::Warning("Closing a connection whose request could not be allocated");
+    }
+    close_connection(fd);
+}
+
+void PredictionServer::serve_requests(int fd) {
+    Request request;
+    while (read_full(fd, &request.header, sizeof(request.header))) {
+        if (request.header.num_rows > batch_size) {
+            Log::Warning("Closing a connection that sent a request of %u rows, more than serve_batch_size %lu",
+                         request.header.num_rows, batch_size);
+            return;
+        }
+        const uint32_t sent_features = request.header.num_features;
+        request.header.num_features = std::min<uint32_t>(sent_features, num_features);
+        request.rows.resize(size_t(request.header.num_rows) * request.header.num_features);
+        if (!read_rows(fd, request.header.num_rows, sent_features, request.header.num_features,
+                       request.rows.data())) return;
+        request.scores.resize(request.header.num_rows);
+        if (request.header.num_rows > 0) {
+            request.done = std::promise<void>();
+            std::future<void> done = request.done.get_future();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(&request);
+            }
+            cond.notify_one();
+            done.wait();
+        }
+        const uint32_t num_rows = request.header.num_rows;
+        if (!write_full(fd, &num_rows, sizeof(num_rows))
+            || !write_full(fd, request.scores.data(), num_rows * sizeof(double))) return;
+    }
+}
+
+void PredictionServer::work() {
+    std::vector<Request*> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return !queue.empty() || stopping; });
+            if (queue.empty()) return;  // stopping
+            // whole requests, as many as fit in batch_size rows, but always at least one
+            size_t num_rows = 0;
+            do {
+                num_rows += queue.front()->header.num_rows;
+                batch.push_back(queue.front());
+                queue.pop_front();
+            } while (!queue.empty() && num_rows + queue.front()->header.num_rows <= batch_size);
+        }
+        score(batch);
+        for (Request* request : batch) request->done.set_value();
+        batch.clear();
+    }
+}
+
+void PredictionServer::score(const std::vector<Request*>& batch) const {
+    std::vector<const float*> rows;
+    std::vector<uint32_t> num_features;
+    for (const Request* request : batch) {
+        for (uint32_t r = 0; r < request->header.num_rows; ++r) {
+            rows.push_back(request->rows.data() + size_t(r) * request->header.num_features);
+            num_features.push_back(request->header.num_features);
+        }
+    }
+    std::vector<double> scores(rows.size());
+    model->predict_batch(rows.size(), [&rows, &num_features](size_t i, feature_t f) {
+        return f < num_features[i] ? rows[i][f] : 0.0f;
+    }, scores.data());
+
+    size_t i = 0;
+    for (Request* request : batch) {
+        std::copy(scores.begin() + i, scores.begin() + i + request->header.num_rows, request->scores.begin());
+        i += request->header.num_rows;
+    }
+}
+
+void run_load_generator(const RawDataset* data, const Config* config) {
+    const size_t num_data = data->num_samples();
+    const uint32_t num_feat = data->shape().second;
+    const size_t batch = config->loadgen_batch_size;
+    if (num_data < batch) {
+        Log::Fatal("loadgen_batch_size %lu is larger than the %lu rows of the data", batch, num_data);
+    }
+    std::vector<float> rows(num_data * num_feat, 0.0f);
+    {
+        std::vector<featval_t> row(num_feat, 0.0);
+        for (size_t i = 0; i < num_data; ++i) {
+            data->copy_row(i, row.data(), num_feat);
+            std::copy(row.begin(), row.end(), rows.begin() + i * num_feat);
+            std::fill(row.begin(), row.end(), 0.0);
+        }
+    }
+
+    const int num_connections = config->loadgen_connections;
+    const int num_requests = config->loadgen_requests;
+    const sockaddr_un address = socket_address(config->socket_path);
+    std::vector<std::vector<double>> latencies(num_connections);
+    // a client that fails records why and stops; the failure is reported once all clients are joined
+    std::vector<std::string> errors(num_connections);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (int c = 0; c < num_connections; ++c) {
+        clients.emplace_back([&, c] {
+            const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+                errors[c] = "Cannot connect to " + config->socket_path + ": " + std::strerror(errno);
+                if (fd >= 0) close(fd);
+                return;
+            }
+            const ServeHeader header = {static_cast<uint32_t>(batch), num_feat};
+            std::vector<double> scores(batch);
+            // connections start at different rows and wrap around the data
+            size_t first = (num_data / num_connections) * c;
+            for (int r = 0; r < num_requests; ++r) {
+                if (first + batch > num_data) first = 0;
+                auto sent = std::chrono::steady_clock::now();
+                uint32_t num_rows = 0;
+                if (!write_full(fd, &header, sizeof(header))
+                    || !write_full(fd, rows.data() + first * num_feat, batch * num_feat * sizeof(float))
+                    || !read_full(fd, &num_rows, sizeof(num_rows)) || num_rows != batch
+                    || !read_full(fd, scores.data(), batch * sizeof(double))) {
+                    errors[c] = "Lost the connection to " + config->socket_path + " after "
+                                + std::to_string(r) + " requests";
+                    break;
+                }
+                latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+                first += batch;
+            }
+            close(fd);
+        });
+    }
+    for (auto& client : clients) client.join();
+    for (int c = 0; c < num_connections; ++c) {
+        if (!errors[c].empty()) {
+            Log::Fatal("loadgen connection %d of %d: %s", c + 1, num_connections, errors[c].c_str());
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))]; };
+    Log::Info("%lu requests of %lu rows from %d connections in %.3f s", all.size(), batch, num_connections, seconds);
+    Log::Info("latency p50 %.1f us, p99 %.1f us; throughput %.0f requests/s, %.0f rows/s",
+              percentile(0.5), percentile(0.99), all.size() / seconds, all.size() * batch / seconds);
+}
+
+}
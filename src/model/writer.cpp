@@ -0,0 +1,113 @@
+#include <lambdamart/writer.h>
+#include <lambdamart/common.h>
+#include <lambdamart/log.h>
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+
+namespace LambdaMART {
+
+ResultFormat result_format_from_string(const std::string& name) {
+    if (name == "text") return ResultFormat::kText;
+    if (name == "float") return ResultFormat::kFloat;
+    if (name == "double") return ResultFormat::kDouble;
+    Log::Fatal("Unknown result_format %s", name.c_str());
+    return ResultFormat::kText;
+}
+
+ResultWriter::ResultWriter(const std::string& path, ResultFormat format) : path(path), format(format) {
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        Log::Fatal("Cannot open result file %s", path.c_str());
+    }
+    worker = std::thread(&ResultWriter::run, this);
+}
+
+ResultWriter::~ResultWriter() noexcept(false) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    worker.join();
+    if (fclose(file) != 0 && error.empty()) {
+        error = strerror(errno);
+    }
+    if (error.empty()) return;
+    if (std::uncaught_exceptions() > 0) {
+        Log::Warning("Failed to write result file %s: %s", path.c_str(), error.c_str());
+        return;
+    }
+    Log::Fatal("Failed to write result file %s: %s", path.c_str(), error.c_str());
+}
+
+template <typename T>
+static void append_binary(const double* scores, size_t num_scores, std::string* block) {
+    block->resize(num_scores * sizeof(T));
+    T* out = reinterpret_cast<T*>(&(*block)[0]);
+    for (size_t i = 0; i < num_scores; ++i) out[i] = static_cast<T>(scores[i]);
+}
+
+void ResultWriter::write(const double* scores, size_t num_scores) {
+    for (size_t start = 0; start < num_scores; start += kBlockSize) {
+        const size_t count = std::min(kBlockSize, num_scores - start);
+        std::string block;
+        if (format == ResultFormat::kFloat) {
+            append_binary<float>(scores + start, count, &block);
+        } else if (format == ResultFormat::kDouble) {
+            append_binary<double>(scores + start, count, &block);
+        } else {
+            // at most 32 characters and a newline per score
+            block.resize(count * 33);
+            char* out = &block[0];
+            for (size_t i = 0; i < count; ++i) {
+                out = Common::ToShortestStr(static_cast<score_t>(scores[start + i]), out);
+                *out++ = '\n';
+            }
+            block.resize(out - block.data());
+        }
+        submit(std::move(block));
+    }
+}
+
+void ResultWriter::submit(std::string&& block) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return !has_pending; });
+        if (!error.empty()) {
+            // reported here, so the destructor does not raise it again
+            const std::string message = std::move(error);
+            error.clear();
+            lock.unlock();
+            Log::Fatal("Failed to write result file %s: %s", path.c_str(), message.c_str());
+        }
+        pending = std::move(block);
+        has_pending = true;
+    }
+    cond.notify_all();
+}
+
+void ResultWriter::run() {
+    std::string block;
+    bool failed = false;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return has_pending || stopping; });
+            if (!has_pending) return;  // stopping, nothing left to write
+            block.swap(pending);
+            has_pending = false;
+        }
+        cond.notify_all();
+        if (failed) continue;  // drain the queue so the caller is not blocked
+        if (fwrite(block.data(), 1, block.size(), file) != block.size()) {
+            const int code = errno;
+            failed = true;
+            std::lock_guard<std::mutex> lock(mutex);
+            error = strerror(code);
+        }
+    }
+}
+
+}
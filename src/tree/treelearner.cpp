@@ -1,27 +1,56 @@
 #include <lambdamart/treelearner.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
 #include <numeric>
 
 namespace LambdaMART {
 
 
-Tree* TreeLearner::build_new_tree()
+Tree* TreeLearner::build_new_tree(int iter)
 {
     std::fill(sample_to_node.begin(), sample_to_node.end(), 1);
     std::fill(node_to_output.begin(), node_to_output.end(), 0.0);
+    partition.init(num_samples, node_to_output.size());
     best_splits.clear();
     split_candidates.clear();
     histograms.clear();
 
+    cur_iter = iter;
+    sample_rows(iter);
+    if (tree_features.empty() || config->feature_fraction < 1.0) {
+        std::vector<feature_t> all_features(num_features);
+        std::iota(all_features.begin(), all_features.end(), 0);
+        sample_features(config->feature_fraction, all_features,
+                        static_cast<uint32_t>(config->feature_fraction_seed) + iter * 2654435761u, &tree_features);
+    }
+    if (quantized) quantize_gradients(iter);
+    NodeStats* topInfo;
+    if (active_rows.empty()) {
+        topInfo = new NodeStats(num_samples, 0.0);  // sum_gradients is always 0 for root node
+    } else {
+        partition.set_active(active_rows.data(), static_cast<sample_t>(active_rows.size()));
+        topInfo = new NodeStats();
+        for (sample_t sample : active_rows) {
+            const gradient_t weight = weighted_rows ? row_weights[sample] : 1.0;
+            topInfo->update(weight, weight * gradients[sample]);
+        }
+    }
+
     Tree* root = new TreeNode(1);
-    auto* topInfo = new NodeStats(num_samples, 0.0);  // sum_gradients is always 0 for root node
-    node_queue.push(new SplitCandidate(root, topInfo));
     LOG_DEBUG("build_new_tree: initialized");
 
-    cur_depth = 1;
-    while (cur_depth <= config->max_depth) {  // TODO: check num_leaves
-        if(!select_split_candidates()) break;  // no more nodes to split -> break
-        find_best_splits();
-        perform_split();
+    if (config->max_leaves > 0) {
+        grow_leaf_wise(root, topInfo);
+    } else {
+        node_queue.push(new SplitCandidate(root, topInfo));
+        cur_depth = 1;
+        while (cur_depth <= config->max_depth) {
+            if(!select_split_candidates()) break;  // no more nodes to split -> break
+            find_best_splits();
+            perform_split();
+        }
     }
 
     // mark remaining candidates as leaves
@@ -31,15 +60,146 @@ Tree* TreeLearner::build_new_tree()
         candidate->node->is_leaf = true;
     }
 
+    leaves.clear();
+    collect_leaves(root);
+
     return root;
 }
 
+void TreeLearner::collect_leaves(TreeNode* node) {
+    if (node->is_leaf) {
+        leaves.push_back(node);
+    } else {
+        collect_leaves(node->left_child);
+        collect_leaves(node->right_child);
+    }
+}
+
+void TreeLearner::update_scores(score_t* scores, double learning_rate, gradient_t* gradients_to_clear, gradient_t* hessians_to_clear) {
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t l = 0; l < leaves.size(); ++l) {
+        const nodeidx_t node = leaves[l]->id;
+        const score_t delta = static_cast<score_t>(learning_rate * node_to_output[node]);
+        const sample_t* samples = partition.samples(node);
+        const sample_t count = partition.count(node);
+        for (sample_t k = 0; k < count; ++k) {
+            const sample_t sample = samples[k];
+            scores[sample] += delta;
+            gradients_to_clear[sample] = 0.0;
+            hessians_to_clear[sample] = 0.0;
+        }
+    }
+}
+
+void TreeLearner::sample_rows(int iter) {
+    weighted_rows = false;
+    if (config->goss) {
+        goss_rows(iter);
+    } else if (config->bagging_freq > 0 && config->bagging_fraction < 1.0) {
+        bag_queries(iter);
+    } else {
+        active_rows.clear();
+    }
+}
+
+void TreeLearner::bag_queries(int iter) {
+    // a bag is kept for bagging_freq iterations and only depends on the iteration that drew it,
+    // so resuming from a checkpoint draws the same rows
+    const int draw_iter = iter - (iter - 1) % config->bagging_freq;
+    if (draw_iter == bag_iter) return;
+    bag_iter = draw_iter;
+
+    // lambdas are computed per query, so whole queries are kept or dropped
+    const sample_t num_queries = dataset->num_queries();
+    const sample_t* boundaries = dataset->get_query_boundaries();
+    const int num_bagged = std::max(1, static_cast<int>(num_queries * config->bagging_fraction + 0.5));
+    Random rand(static_cast<uint32_t>(config->bagging_seed) + draw_iter * 2654435761u);
+    active_rows.clear();
+    for (int query : rand.Sample(num_queries, num_bagged)) {
+        for (sample_t sample = boundaries[query]; sample < boundaries[query + 1]; ++sample) {
+            active_rows.push_back(sample);
+        }
+    }
+}
+
+void TreeLearner::goss_rows(int iter) {
+    const auto top_k = static_cast<sample_t>(num_samples * config->top_rate);
+    const auto other_k = std::max<sample_t>(1, static_cast<sample_t>(num_samples * config->other_rate));
+    active_rows.clear();
+    if (top_k + other_k >= num_samples) return;
+
+    // |gradient| of the top_k-th largest sample; all samples at or above it are kept with weight 1
+    std::vector<gradient_t> magnitude(num_samples);
+    for (sample_t sample = 0; sample < num_samples; ++sample) {
+        magnitude[sample] = std::fabs(gradients[sample]);
+    }
+    gradient_t threshold = std::numeric_limits<gradient_t>::infinity();
+    if (top_k > 0) {
+        std::nth_element(magnitude.begin(), magnitude.begin() + (top_k - 1), magnitude.end(), std::greater<gradient_t>());
+        threshold = magnitude[top_k - 1];
+    }
+
+    // the rest is sampled without replacement and scaled up, so that histogram sums stay unbiased
+    const gradient_t multiply = static_cast<gradient_t>(num_samples - top_k) / other_k;
+    Random rand(static_cast<uint32_t>(config->bagging_seed) + iter * 2654435761u);
+    sample_t num_big = 0;
+    for (sample_t sample = 0; sample < num_samples; ++sample) {
+        if (std::fabs(gradients[sample]) >= threshold) {
+            active_rows.push_back(sample);
+            row_weights[sample] = 1.0;
+            ++num_big;
+        } else {
+            const double needed = static_cast<double>(other_k) - (active_rows.size() - num_big);
+            const double remaining = static_cast<double>(num_samples - sample) - (top_k > num_big ? top_k - num_big : 0);
+            if (rand.NextFloat() < needed / remaining) {
+                active_rows.push_back(sample);
+                row_weights[sample] = multiply;
+            }
+        }
+    }
+    weighted_rows = true;
+}
+
+void TreeLearner::quantize_gradients(int iter) {
+    // the largest level is also capped so that a bin of all active rows cannot overflow int32
+    const sample_t num_active = active_rows.empty() ? num_samples : static_cast<sample_t>(active_rows.size());
+    const int max_level = std::min((1 << (config->gradient_bits - 1)) - 1,
+                                   std::max(1, static_cast<int>(std::numeric_limits<int32_t>::max() / std::max<sample_t>(num_active, 1))));
+    gradient_t max_gradient = 0.0;
+    for (sample_t sample = 0; sample < num_samples; ++sample) {
+        max_gradient = std::max(max_gradient, static_cast<gradient_t>(std::fabs(gradients[sample])));
+    }
+    gradient_scale = max_gradient > 0.0 ? max_gradient / max_level : 1.0;
+
+    // stochastic rounding keeps every quantized gradient an unbiased estimate of the original
+    const gradient_t inverse_scale = 1.0 / gradient_scale;
+    Random rand(static_cast<uint32_t>(config->bagging_seed) + iter * 2654435761u + 12345u);
+    for (sample_t sample = 0; sample < num_samples; ++sample) {
+        const gradient_t scaled = gradients[sample] * inverse_scale;
+        const int level = static_cast<int>(std::floor(scaled + rand.NextFloat()));
+        quantized_gradients[sample] = static_cast<int16_t>(std::max(-max_level, std::min(max_level, level)));
+    }
+}
+
+void TreeLearner::sample_features(double fraction, const std::vector<feature_t>& from, uint32_t seed,
+                                  std::vector<feature_t>* out) {
+    if (fraction >= 1.0) {
+        *out = from;
+        return;
+    }
+    const int total = static_cast<int>(from.size());
+    const int num_used = std::max(1, static_cast<int>(total * fraction + 0.5));
+    Random rand(seed);
+    out->clear();
+    for (int i : rand.Sample(total, num_used)) {
+        out->push_back(from[i]);
+    }
+}
+
 bool TreeLearner::select_split_candidates() {
     LOG_DEBUG("select_split_candidates");
 
     std::fill(node_to_candidate.begin(), node_to_candidate.end(), -1);
-    sample_to_candidate.clear();
-    sample_to_candidate.resize(num_samples);
     split_candidates.clear();
     node_info.clear();
 
@@ -53,12 +213,7 @@ bool TreeLearner::select_split_candidates() {
         node_to_candidate[candidate->node->id] = num_candidates++;
     }
 
-    if (!num_candidates) return false;
-
-    for (sample_t sample = 0; sample < num_samples; ++sample) {
-        sample_to_candidate[sample] = node_to_candidate[sample_to_node[sample]];
-    }
-    return true;
+    return num_candidates > 0;
 }
 
 
@@ -70,30 +225,125 @@ void TreeLearner::find_best_splits() {
 
     best_splits.clear();
     best_splits.resize(num_candidates);
-    for (feature_t fid = 0; fid < num_features; ++fid) {
+
+    // every level draws its own subset of the tree's features
+    sample_features(config->feature_fraction_bynode, tree_features,
+                    static_cast<uint32_t>(config->feature_fraction_seed) + cur_iter * 2654435761u + cur_depth * 40503u,
+                    &level_features);
+
+    // features of a bundle are visited through one histogram of the bundle column
+    std::fill(feature_in_level.begin(), feature_in_level.end(), false);
+    std::vector<int> level_bundles;
+    for (feature_t fid : level_features) {
+        feature_in_level[fid] = true;
+        const int bundle = dataset->bundle_of(fid);
+        if (bundle >= 0) {
+            if (std::find(level_bundles.begin(), level_bundles.end(), bundle) == level_bundles.end())
+                level_bundles.push_back(bundle);
+            continue;
+        }
+
         LOG_TRACE("checking feature %lu", fid);
         histograms.clear(num_candidates);
         const Feature &feat = dataset->get_data()[fid];
-
-        //TODO: unrolling
-        for (sample_t sample_idx = 0; sample_idx < num_samples; ++sample_idx) {
-            const int candidate = sample_to_candidate[sample_idx];
-            if (candidate != -1) {
-                const bin_t bin = feat.bin_index[sample_idx];
-                histograms[candidate][bin].update(1.0, gradients[sample_idx]);
-            }
+        for (nodeidx_t candidate = 0; candidate < num_candidates; ++candidate) {
+            build_histogram(split_candidates[candidate]->node->id, feat.bin_index.data(), histograms[candidate], config->max_bin);
         }
 
         for (nodeidx_t candidate = 0; candidate < num_candidates; ++candidate) {
             histograms.cumulate(candidate);
-            auto local_best = histograms.get_best_split(candidate, fid, feat, node_info[candidate], min_data_in_leaf);
-            if (local_best >= best_splits[candidate]) {
-                best_splits[candidate] = local_best;
+            keep_better_split(&best_splits[candidate],
+                              histograms.get_best_split(candidate, fid, feat, node_info[candidate], min_data_in_leaf));
+        }
+    }
+
+    for (int b : level_bundles) {
+        const FeatureBundle& bundle = dataset->get_bundles()[b];
+        LOG_TRACE("checking bundle %d of %lu features", b, bundle.features.size());
+        histograms.clear(num_candidates);
+        for (nodeidx_t candidate = 0; candidate < num_candidates; ++candidate) {
+            build_histogram(split_candidates[candidate]->node->id, bundle.bin_index.data(), histograms[candidate], config->max_bin);
+        }
+
+        for (size_t k = 0; k < bundle.features.size(); ++k) {
+            const feature_t fid = bundle.features[k];
+            if (!feature_in_level[fid]) continue;
+            const Feature &feat = dataset->get_data()[fid];
+            for (nodeidx_t candidate = 0; candidate < num_candidates; ++candidate) {
+                unbundle_histogram(bundle, k, histograms[candidate], feature_histograms[candidate]);
+                feature_histograms.cumulate(candidate);
+                keep_better_split(&best_splits[candidate],
+                                  feature_histograms.get_best_split(candidate, fid, feat, node_info[candidate], min_data_in_leaf));
             }
         }
     }
 }
 
+void TreeLearner::keep_better_split(SplitInfo* best, const SplitInfo& local_best) {
+    // ties go to the larger feature id, like a scan over ascending features would decide them
+    if (local_best.gain > best->gain || (local_best.gain == best->gain &&
+            (best->split == nullptr || local_best.split->feature > best->split->feature))) {
+        if (best->split != nullptr) {
+            delete best->split;
+            delete best->left_stats;
+            delete best->right_stats;
+        }
+        *best = local_best;
+    } else {
+        delete local_best.split;
+        delete local_best.left_stats;
+        delete local_best.right_stats;
+    }
+}
+
+template <typename BinType>
+void TreeLearner::build_histogram(nodeidx_t node, const BinType* bin_index, Bin* hist, int num_bins) {
+    // only the active rows of the node, which lead its partition range
+    const sample_t* samples = partition.samples(node);
+    const sample_t active = partition.active(node);
+    if (quantized) {
+        // accumulate into 8-byte integer bins, then rescale once per bin
+        IntBin* int_hist = int_histogram.data();
+        std::fill(int_hist, int_hist + num_bins, IntBin());
+        for (sample_t k = 0; k < active; ++k) {
+            const sample_t sample = samples[k];
+            int_hist[bin_index[sample]].update(quantized_gradients[sample]);
+        }
+        for (int bin = 0; bin < num_bins; ++bin) {
+            hist[bin].update(int_hist[bin].sum_count, int_hist[bin].sum_gradients * gradient_scale);
+        }
+    } else if (weighted_rows) {
+        for (sample_t k = 0; k < active; ++k) {
+            const sample_t sample = samples[k];
+            const gradient_t weight = row_weights[sample];
+            hist[bin_index[sample]].update(weight, weight * gradients[sample]);
+        }
+    } else {
+        //TODO: unrolling
+        for (sample_t k = 0; k < active; ++k) {
+            const sample_t sample = samples[k];
+            hist[bin_index[sample]].update(1.0, gradients[sample]);
+        }
+    }
+}
+
+void TreeLearner::unbundle_histogram(const FeatureBundle& bundle, size_t k, const Bin* bundle_hist, Bin* out) {
+    const Feature& feat = dataset->get_data()[bundle.features[k]];
+    std::fill(out, out + config->max_bin, Bin());
+    // the default bin holds whatever the other bins of the feature do not
+    Bin rest;
+    for (int b = 0; b < bundle.num_bins; ++b) {
+        rest += bundle_hist[b];
+    }
+    for (int bin = 0; bin < feat.bin_count(); ++bin) {
+        const int bundle_bin = bundle.bundle_bin(k, bin);
+        if (bundle_bin < 0) continue;
+        out[bin] = bundle_hist[bundle_bin];
+        rest = rest - out[bin];
+    }
+    out[bundle.default_bins[k]] = rest;
+}
+
 void TreeLearner::perform_split()
 {
     LOG_DEBUG("perform_split");
@@ -114,21 +364,12 @@ void TreeLearner::perform_split()
         }
     }
 
-    // update sample_to_node for affected samples, and aggregate their lambdas and weights for children nodes
-    for (sample_t sample = 0; sample < num_samples; ++sample) {
-        int candidate = sample_to_candidate[sample];
-        if (candidate < 0 || !do_split[candidate]) continue;
-
-        const feature_t feature = best_splits[candidate].split->feature;
-        const bin_t bin = best_splits[candidate].bin;
-        // TODO: is there a way to optimize this 2-level random access?
-        if (dataset->get_data()[feature].bin_index[sample] <= bin) {
-            sample_to_node[sample] <<= 1;  // move to left child
-            best_splits[candidate].update_children_stats(gradients[sample] * gradients[sample], hessians[sample], 0., 0.);
-        } else {
-            sample_to_node[sample] = (sample_to_node[sample] << 1) + 1;  // move to right child
-            best_splits[candidate].update_children_stats(0., 0., gradients[sample] * gradients[sample], hessians[sample]);
-        }
+    // partition the samples of every split node; this moves them to the children in sample_to_node
+    // and aggregates their lambdas and weights for the children nodes
+    #pragma omp parallel for schedule(dynamic)
+    for (nodeidx_t candidate = 0; candidate < num_candidates; ++candidate) {
+        if (!do_split[candidate]) continue;
+        partition_node(split_candidates[candidate]->node->id, best_splits[candidate]);
     }
 
     // create the children nodes
@@ -138,30 +379,14 @@ void TreeLearner::perform_split()
             auto& splitInfo = best_splits[candidate];
             LOG_TRACE("split on Node %lu = Candidate %lu: %s",split_candidates[candidate]->node->id, candidate, splitInfo.toString().c_str());
             TreeNode* candidate_node = split_candidates[candidate]->node;
-            candidate_node->split = splitInfo.split;
-            score_t left_impurity = splitInfo.get_left_impurity();
-            score_t right_impurity = splitInfo.get_right_impurity();
-            score_t left_output = splitInfo.get_left_output();
-            score_t right_output = splitInfo.get_right_output();
-
-            // depth of children is still smaller than max_depth -> they can be further split
-            bool child_is_leaf = (candidate_node->get_level() + 1 >= config->max_depth);
-            bool left_child_is_leaf = (child_is_leaf || left_impurity < config->min_impurity_to_split);
-            bool right_child_is_leaf = (child_is_leaf || right_impurity < config->min_impurity_to_split);
-            LOG_TRACE(" child_is_leaf: %d\n\t\t  left_child_is_leaf: %d\n\t\t  right_child_is_leaf: %d",
-                    child_is_leaf, left_child_is_leaf, right_child_is_leaf);
-
-            TreeNode* left_child = new TreeNode(candidate_node->get_left_child_index(), left_output, left_impurity, left_child_is_leaf);
-            TreeNode* right_child = new TreeNode(candidate_node->get_right_child_index(), right_output, right_impurity, right_child_is_leaf);
-            candidate_node->left_child = left_child;
-            candidate_node->right_child = right_child;
-            node_to_output[left_child->id] = left_output;
-            node_to_output[right_child->id] = right_output;
-
-            if (!left_child_is_leaf) {
+            create_children(candidate_node, splitInfo);
+            TreeNode* left_child = candidate_node->left_child;
+            TreeNode* right_child = candidate_node->right_child;
+
+            if (!left_child->is_leaf) {
                 node_queue.push(new SplitCandidate(left_child, splitInfo.left_stats));
             }
-            if (!right_child_is_leaf) {
+            if (!right_child->is_leaf) {
                 node_queue.push(new SplitCandidate(right_child, splitInfo.right_stats));
             }
 
@@ -170,4 +395,223 @@ void TreeLearner::perform_split()
     }
 }
 
+void TreeLearner::partition_node(nodeidx_t node, SplitInfo& split_info) {
+    const feature_t feature = split_info.split->feature;
+    const bin_t bin = split_info.bin;
+    gradient_t left_gradients = 0.0, right_gradients = 0.0;
+    // rows left out of this tree follow the split, but do not count for the children stats
+    auto split_node = [&](auto&& goes_left) {
+        partition.split(node, [&](sample_t sample, bool active) {
+            const gradient_t weight = !active ? 0.0 : (weighted_rows ? row_weights[sample] : 1.0);
+            if (goes_left(sample)) {
+                sample_to_node[sample] = node << 1;  // move to left child
+                if (active) {
+                    split_info.update_children_stats(weight * gradients[sample] * gradients[sample], weight * hessians[sample], 0., 0.);
+                    left_gradients += gradients[sample];
+                }
+                return true;
+            } else {
+                sample_to_node[sample] = (node << 1) + 1;  // move to right child
+                if (active) {
+                    split_info.update_children_stats(0., 0., weight * gradients[sample] * gradients[sample], weight * hessians[sample]);
+                    right_gradients += gradients[sample];
+                }
+                return false;
+            }
+        });
+    };
+
+    const int b = dataset->bundle_of(feature);
+    if (b < 0) {
+        const vector<int>& bin_index = dataset->get_data()[feature].bin_index;
+        split_node([&](sample_t sample) { return bin_index[sample] <= bin; });
+    } else {
+        // direction of every bundle bin, decoded once per split
+        const FeatureBundle& bundle = dataset->get_bundles()[b];
+        const size_t k = std::find(bundle.features.begin(), bundle.features.end(), feature) - bundle.features.begin();
+        std::vector<uint8_t> left_of_bin(bundle.num_bins);
+        for (int bundle_bin = 0; bundle_bin < bundle.num_bins; ++bundle_bin) {
+            left_of_bin[bundle_bin] = bundle.feature_bin(k, bundle_bin) <= bin;
+        }
+        const bin_t* bin_index = bundle.bin_index.data();
+        split_node([&](sample_t sample) { return left_of_bin[bin_index[sample]] != 0; });
+    }
+
+    // the histograms only saw quantized gradients; outputs and impurities use the exact sums
+    if (quantized) {
+        split_info.left_stats->sum_gradients = left_gradients;
+        split_info.right_stats->sum_gradients = right_gradients;
+    }
+}
+
+void TreeLearner::create_children(TreeNode* node, SplitInfo& split_info) {
+    node->split = split_info.split;
+    score_t left_impurity = split_info.get_left_impurity();
+    score_t right_impurity = split_info.get_right_impurity();
+    score_t left_output = split_info.get_left_output();
+    score_t right_output = split_info.get_right_output();
+
+    // depth of children is still smaller than max_depth -> they can be further split
+    bool child_is_leaf = (node->get_level() + 1 >= config->max_depth);
+    bool left_child_is_leaf = (child_is_leaf || left_impurity < config->min_impurity_to_split);
+    bool right_child_is_leaf = (child_is_leaf || right_impurity < config->min_impurity_to_split);
+    LOG_TRACE(" child_is_leaf: %d\n\t\t  left_child_is_leaf: %d\n\t\t  right_child_is_leaf: %d",
+            child_is_leaf, left_child_is_leaf, right_child_is_leaf);
+
+    TreeNode* left_child = new TreeNode(node->get_left_child_index(), left_output, left_impurity, left_child_is_leaf);
+    TreeNode* right_child = new TreeNode(node->get_right_child_index(), right_output, right_impurity, right_child_is_leaf);
+    node->left_child = left_child;
+    node->right_child = right_child;
+    node_to_output[left_child->id] = left_output;
+    node_to_output[right_child->id] = right_output;
+}
+
+void TreeLearner::init_columns() {
+    // a column is a feature with its own bin_index or a whole bundle
+    feature_to_column.assign(num_features, -1);
+    columns.clear();
+    column_bins = 0;
+    for (feature_t fid = 0; fid < num_features; ++fid) {
+        const int bundle = dataset->bundle_of(fid);
+        int& column = bundle < 0 ? feature_to_column[fid] : feature_to_column[dataset->get_bundles()[bundle].features[0]];
+        if (column < 0) {
+            const int bins = bundle < 0 ? dataset->get_data()[fid].bin_count() : dataset->get_bundles()[bundle].num_bins;
+            column = static_cast<int>(columns.size());
+            columns.push_back(Column{bundle < 0 ? static_cast<int>(fid) : -1, bundle, std::max(bins, 1), column_bins});
+            column_bins += columns.back().num_bins;
+        }
+        feature_to_column[fid] = column;
+    }
+    column_in_tree.assign(columns.size(), false);
+}
+
+void TreeLearner::build_node_histograms(nodeidx_t node, Bin* out) {
+    std::fill(out, out + column_bins, Bin());
+    for (size_t c = 0; c < columns.size(); ++c) {
+        if (!column_in_tree[c]) continue;
+        const Column& column = columns[c];
+        if (column.bundle < 0) {
+            build_histogram(node, dataset->get_data()[column.feature].bin_index.data(), out + column.offset, column.num_bins);
+        } else {
+            build_histogram(node, dataset->get_bundles()[column.bundle].bin_index.data(), out + column.offset, column.num_bins);
+        }
+    }
+}
+
+SplitInfo TreeLearner::find_best_split(const Bin* node_histograms, const TreeNode* node, const NodeStats* info) {
+    // features are drawn per level, as in level-wise growth
+    sample_features(config->feature_fraction_bynode, tree_features,
+                    static_cast<uint32_t>(config->feature_fraction_seed) + cur_iter * 2654435761u + node->get_level() * 40503u,
+                    &level_features);
+
+    // row 0 of `histograms` is the scratch space of one feature
+    SplitInfo best = SplitInfo();
+    Bin* scratch = histograms[0];
+    for (feature_t fid : level_features) {
+        const Column& column = columns[feature_to_column[fid]];
+        const Bin* column_hist = node_histograms + column.offset;
+        if (column.bundle < 0) {
+            std::fill(scratch, scratch + config->max_bin, Bin());
+            std::copy(column_hist, column_hist + column.num_bins, scratch);
+        } else {
+            const FeatureBundle& bundle = dataset->get_bundles()[column.bundle];
+            const size_t k = std::find(bundle.features.begin(), bundle.features.end(), fid) - bundle.features.begin();
+            unbundle_histogram(bundle, k, column_hist, scratch);
+        }
+        histograms.cumulate(0);
+        keep_better_split(&best, histograms.get_best_split(0, fid, dataset->get_data()[fid], info, min_data_in_leaf));
+    }
+    return best;
+}
+
+void TreeLearner::grow_leaf_wise(TreeNode* root, NodeStats* root_info) {
+    LOG_DEBUG("grow_leaf_wise");
+    const int max_leaves = config->max_leaves;
+
+    // histograms are only built for the columns of the tree's features
+    std::fill(column_in_tree.begin(), column_in_tree.end(), false);
+    for (feature_t fid : tree_features) {
+        column_in_tree[feature_to_column[fid]] = true;
+    }
+
+    // every splittable leaf keeps its histograms in a slot until it is split
+    if (leaf_histograms.size() < static_cast<size_t>(max_leaves)) leaf_histograms.resize(max_leaves);
+    std::vector<int> free_slots;
+    for (int slot = max_leaves - 1; slot >= 0; --slot) {
+        free_slots.push_back(slot);
+    }
+    auto acquire_slot = [&]() {
+        const int slot = free_slots.back();
+        free_slots.pop_back();
+        leaf_histograms[slot].resize(column_bins);
+        return slot;
+    };
+
+    std::priority_queue<LeafCandidate> queue;
+    auto evaluate = [&](TreeNode* node, NodeStats* info, int slot) {
+        queue.push(LeafCandidate{node, info, find_best_split(leaf_histograms[slot].data(), node, info), slot});
+    };
+
+    const int root_slot = acquire_slot();
+    build_node_histograms(root->id, leaf_histograms[root_slot].data());
+    evaluate(root, root_info, root_slot);
+
+    int num_leaves = 1;
+    while (num_leaves < max_leaves && !queue.empty()) {
+        LeafCandidate leaf = queue.top();
+        if (leaf.best.gain <= config->min_gain_to_split) break;
+        queue.pop();
+
+        TreeNode* node = leaf.node;
+        LOG_TRACE("split leaf %lu: %s", node->id, leaf.best.toString().c_str());
+        node->is_leaf = false;
+        partition_node(node->id, leaf.best);
+        create_children(node, leaf.best);
+        ++num_leaves;
+
+        // children that may split again stay leaves until they do
+        TreeNode* children[2] = {node->left_child, node->right_child};
+        NodeStats* children_info[2] = {leaf.best.left_stats, leaf.best.right_stats};
+        bool splittable[2];
+        for (int c = 0; c < 2; ++c) {
+            splittable[c] = !children[c]->is_leaf;
+            children[c]->is_leaf = true;
+        }
+        if (!splittable[0] && !splittable[1]) {
+            free_slots.push_back(leaf.slot);
+            continue;
+        }
+
+        // only the smaller child is built from its rows; the larger one is the parent minus the smaller
+        const int small = partition.active(children[0]->id) <= partition.active(children[1]->id) ? 0 : 1;
+        const int large = 1 - small;
+        const int small_slot = acquire_slot();
+        build_node_histograms(children[small]->id, leaf_histograms[small_slot].data());
+        if (splittable[large]) {
+            Bin* parent = leaf_histograms[leaf.slot].data();
+            const Bin* sibling = leaf_histograms[small_slot].data();
+            for (size_t i = 0; i < column_bins; ++i) {
+                parent[i] = parent[i] - sibling[i];
+            }
+            evaluate(children[large], children_info[large], leaf.slot);
+        } else {
+            free_slots.push_back(leaf.slot);
+        }
+        if (splittable[small]) {
+            evaluate(children[small], children_info[small], small_slot);
+        } else {
+            free_slots.push_back(small_slot);
+        }
+    }
+
+    // the candidates left in the queue stay leaves; their splits are dropped
+    while (!queue.empty()) {
+        const SplitInfo& unused = queue.top().best;
+        delete unused.split;
+        delete unused.left_stats;
+        delete unused.right_stats;
+        queue.pop();
+    }
+}
+
 }
@@ -18,9 +18,76 @@ create_conf()
 
 mkdir -p logs
 
+
+# round trips of every task and model format on the shipped data/lightgbm/rank.test: each
+# step's predictions are compared byte for byte with those of the step they should equal
+failed=0
+
+run()
+{
+    if ! ./lambdamart tests/roundtrip.$1.conf &> logs/roundtrip.$1.log; then
+        echo "roundtrip: $1 failed, see logs/roundtrip.$1.log"
+        failed=1
+    fi
+}
+
+same()
+{
+    if ! cmp -s roundtrip/$1 roundtrip/$2; then
+        echo "roundtrip: $1 and $2 differ"
+        failed=1
+    fi
+}
+
+rm -rf roundtrip
+mkdir -p roundtrip
+
+# train -> predict: scores of the binned validation data equal those of the raw rows
+run train
+run predict.v2
+same train.txt v2.txt
+
+# v1 -> v2: a model of the version 1 format, continued for 0 iterations, saves as version 2
+run predict.v1
+run warmstart
+run predict.v1to2
+same v1.txt warmstart.txt
+same v1.txt v1to2.txt
+run compress.v1to2
+
+# v2 -> v3: compressing a compressed model changes nothing
+run compress
+run predict.v3
+run recompress
+run predict.v3.again
+same v3.txt v3.again.txt
+
+# export: the compiled model scores like the one it was exported from
+run export
+if c++ -O2 -shared -fPIC roundtrip/v3.cpp -o roundtrip/v3.so; then
+    run predict.compiled
+    same v3.txt compiled.txt
+else
+    echo "roundtrip: roundtrip/v3.cpp does not compile"
+    failed=1
+fi
+
+# serve + loadgen
+./lambdamart tests/roundtrip.serve.conf &> logs/roundtrip.serve.log &
+server=$!
+for i in $(seq 50); do [ -S roundtrip/serve.sock ] && break; sleep 0.1; done
+run loadgen
+kill $server
+
+if [ $failed -eq 0 ]; then
+    echo "roundtrip: all passed"
+fi
+
 for i in $(seq 10 1 21)
 do
     create_conf $i
     ./lambdamart tmp.$i.conf &> logs/mslr.$i.log
     rm tmp.$i.conf
 done
+
+exit $failed